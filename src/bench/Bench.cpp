@@ -0,0 +1,359 @@
+#include "bench/Bench.h"
+#include "lib/adapter/artifact/Artifact.h"
+#include "lib/adapter/rtabmap/RTABMapAdapter.h"
+#include "lib/algo/Feature.h"
+#include "lib/algo/Perspective.h"
+#include "lib/algo/RoomSearch.h"
+#include "lib/algo/WordSearch.h"
+#include "lib/data/Transform.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+// the p-th percentile of sorted values, by nearest rank
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.5);
+  return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+} // namespace
+
+int Bench::run(int argc, char *argv[]) {
+  // Parse arguments
+  std::string artifactPath;
+  std::vector<std::string> annTypes;
+  AnnParams annParams;
+  int numImages;
+  int featureLimit;
+  int featureThreads;
+  int maxResolution;
+  float distRatio;
+  int clusterBatchSize;
+  int clusterChecks;
+  int loadThreads;
+  std::vector<int> stressThreads;
+  int stressRounds;
+  std::vector<std::string> pnpTypes;
+  std::vector<std::string> dbFiles;
+
+  po::options_description visible("command options");
+  visible.add_options() // use comment to force new line using formater
+      ("help,h", "print help message") //
+      ("artifact,a", po::value<std::string>(&artifactPath),
+       "read words from an artifact instead of creating them") //
+      ("ann", po::value<std::vector<std::string>>(&annTypes)
+                  ->multitoken()
+                  ->default_value({"flann", "hnsw", "brute"},
+                                  "flann hnsw brute"),
+       "word indexes to benchmark") //
+      ("ann-trees",
+       po::value<int>(&annParams.flannTrees)->default_value(FLANN_TREES),
+       "KD-trees in a flann word index") //
+      ("ann-checks",
+       po::value<int>(&annParams.flannChecks)->default_value(FLANN_CHECKS),
+       "leaves checked per descriptor in a flann word index") //
+      ("hnsw-m", po::value<int>(&annParams.hnswM)->default_value(HNSW_M),
+       "links per node in an hnsw word index") //
+      ("hnsw-ef-construction",
+       po::value<int>(&annParams.hnswEfConstruction)
+           ->default_value(HNSW_EF_CONSTRUCTION),
+       "candidates kept while building an hnsw word index") //
+      ("hnsw-ef", po::value<int>(&annParams.hnswEf)->default_value(HNSW_EF),
+       "candidates kept per descriptor in an hnsw word index") //
+      ("images,n", po::value<int>(&numImages)->default_value(100),
+       "query images, spread evenly over the database images") //
+      ("feature-limit,f", po::value<int>(&featureLimit)->default_value(0),
+       "limit the number of features used") //
+      ("feature-threads",
+       po::value<int>(&featureThreads)->default_value(FEATURE_THREADS),
+       "extract the features of an image in tiles on n threads") //
+      ("max-resolution", po::value<int>(&maxResolution)->default_value(0),
+       "downsample images to at most n pixels on the longer side in the "
+       "stress test, 0 means full resolution") //
+      ("dist-ratio,d", po::value<float>(&distRatio)->default_value(0.7),
+       "distance ratio used to create words") //
+      ("cluster-batch", po::value<int>(&clusterBatchSize)->default_value(0),
+       "cluster words approximately in parallel, n descriptors at a time, "
+       "0 means exact clustering") //
+      ("cluster-checks", po::value<int>(&clusterChecks)->default_value(32),
+       "KD-tree leaves checked per descriptor in approximate clustering") //
+      ("load-threads", po::value<int>(&loadThreads)->default_value(0),
+       "threads used to read databases, create words and build indexes, 0 "
+       "means one per core") //
+      ("stress-threads",
+       po::value<std::vector<int>>(&stressThreads)->multitoken(),
+       "also localize the query images concurrently with each number of "
+       "threads, using the first word index") //
+      ("stress-rounds", po::value<int>(&stressRounds)->default_value(4),
+       "times each query image is localized in the stress test") //
+      ("pnp", po::value<std::vector<std::string>>(&pnpTypes)->multitoken(),
+       "also compare pose estimation types, e.g. ransac prosac, on the exact "
+       "words of the query images. The first is used in the stress test.");
+
+  po::options_description hidden;
+  hidden.add_options() // use comment to force new line using formater
+      ("dbfiles", po::value<std::vector<std::string>>(&dbFiles)
+                      ->multitoken()
+                      ->required(),
+       "database files");
+
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::positional_options_description pos;
+  pos.add("dbfiles", -1);
+
+  po::variables_map vm;
+  po::parsed_options parsed = po::command_line_parser(argc, argv)
+                                  .options(all)
+                                  .positional(pos)
+                                  .allow_unregistered()
+                                  .run();
+  po::store(parsed, vm);
+
+  // print invalid options
+  std::vector<std::string> unrecog =
+      collect_unrecognized(parsed.options, po::exclude_positional);
+  if (unrecog.size() > 0) {
+    printInvalid(unrecog);
+    printUsage(visible);
+    return 1;
+  }
+
+  if (vm.count("help")) {
+    printUsage(visible);
+    return 0;
+  }
+
+  // check whether required options exist after handling help
+  po::notify(vm);
+
+  // Run the program
+  std::set<std::string> dbPaths(dbFiles.begin(), dbFiles.end());
+  RTABMapAdapter adapter(distRatio, clusterBatchSize, clusterChecks,
+                         loadThreads);
+  if (!adapter.init(dbPaths)) {
+    std::cerr << "reading data failed";
+    return 1;
+  }
+
+  WordStore words;
+  std::map<int, Room> rooms;
+  std::unique_ptr<Artifact> artifact;
+  if (!artifactPath.empty()) {
+    artifact = std::make_unique<Artifact>(artifactPath, dbPaths, distRatio,
+                                          clusterBatchSize, clusterChecks);
+  }
+  if (artifact == nullptr || !artifact->load(words, rooms)) {
+    words = adapter.getWords();
+  }
+  if (words.getNumWords() == 0) {
+    std::cerr << "there are no words" << std::endl;
+    return 1;
+  }
+
+  // query with database images. Their features went into the words, so
+  // recall is optimistic, but it still compares indexes with each other.
+  std::vector<const Image *> images;
+  for (const auto &room : adapter.getImages()) {
+    for (const auto &image : room.second) {
+      images.emplace_back(&image.second);
+    }
+  }
+  std::vector<const Image *> queryImages;
+  std::vector<std::vector<cv::KeyPoint>> queryKeyPoints;
+  std::vector<cv::Mat> queries;
+  Feature feature(featureLimit, featureThreads);
+  size_t step = std::max(images.size() / std::max(numImages, 1), size_t(1));
+  for (size_t i = 0; i < images.size(); i += step) {
+    if (static_cast<int>(queries.size()) >= numImages) {
+      break;
+    }
+    std::vector<cv::KeyPoint> keyPoints;
+    cv::Mat descriptors;
+    feature.extract(images[i]->getImage(), keyPoints, descriptors);
+    if (descriptors.rows > 0) {
+      queryImages.emplace_back(images[i]);
+      queryKeyPoints.emplace_back(std::move(keyPoints));
+      queries.emplace_back(descriptors);
+    }
+  }
+  std::cout << words.getNumWords() << " words, " << queries.size()
+            << " query images" << std::endl;
+
+  // exact nearest words
+  AnnParams exactParams;
+  exactParams.type = "brute";
+  WordSearch exact(words, exactParams);
+  std::vector<cv::Mat> exactDists(queries.size());
+  std::vector<std::vector<int>> exactWordIds(queries.size());
+  for (size_t i = 0; i < queries.size(); i++) {
+    cv::Mat wordIds;
+    exact.search(queries[i], wordIds, exactDists[i], 1);
+    exactWordIds[i].assign(wordIds.begin<int>(), wordIds.end<int>());
+  }
+
+  std::cout << std::left << std::setw(8) << "index" << std::setw(12)
+            << "build ms" << std::setw(12) << "recall@1" << std::setw(12)
+            << "p50 ms" << std::setw(12) << "p99 ms" << std::endl;
+  for (const auto &annType : annTypes) {
+    AnnParams params = annParams;
+    params.type = annType;
+    params.numThreads = loadThreads;
+    if (AnnIndex::create(params) == nullptr) {
+      std::cerr << "unknown word index type " << annType << std::endl;
+      continue;
+    }
+
+    long startTime = Utility::getTime();
+    WordSearch wordSearch(words, params);
+    long buildTime = Utility::getTime() - startTime;
+
+    std::vector<double> latencies;
+    size_t numHits = 0;
+    size_t numDescriptors = 0;
+    for (size_t i = 0; i < queries.size(); i++) {
+      cv::Mat wordIds, dists;
+      auto begin = std::chrono::steady_clock::now();
+      wordSearch.search(queries[i], wordIds, dists, 1);
+      auto end = std::chrono::steady_clock::now();
+      latencies.emplace_back(
+          std::chrono::duration<double, std::milli>(end - begin).count());
+
+      // a hit is a word as near as the exact one, so that ties count
+      for (int j = 0; j < queries[i].rows; j++) {
+        if (wordIds.at<int>(j, 0) >= 0 &&
+            dists.at<float>(j, 0) <= exactDists[i].at<float>(j, 0) * 1.0001f) {
+          numHits++;
+        }
+      }
+      numDescriptors += queries[i].rows;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    double recall =
+        numDescriptors > 0 ? static_cast<double>(numHits) / numDescriptors : 0;
+    std::cout << std::left << std::setw(8) << annType << std::setw(12)
+              << buildTime << std::setw(12) << std::fixed
+              << std::setprecision(4) << recall << std::setw(12)
+              << std::setprecision(3) << percentile(latencies, 50)
+              << std::setw(12) << percentile(latencies, 99) << std::endl;
+  }
+
+  if (rooms.empty()) {
+    rooms = adapter.getRooms();
+  }
+
+  if (!pnpTypes.empty() && !queries.empty()) {
+    RoomSearch roomSearch(rooms, words);
+    std::vector<int> roomIds;
+    for (const auto &wordIds : exactWordIds) {
+      roomIds.emplace_back(roomSearch.search(wordIds));
+    }
+
+    std::cout << std::left << std::setw(8) << "pnp" << std::setw(12)
+              << "success" << std::setw(12) << "inliers" << std::setw(12)
+              << "iterations" << std::setw(12) << "p50 ms" << std::setw(12)
+              << "p99 ms" << std::endl;
+    for (const auto &pnpType : pnpTypes) {
+      Perspective perspective(rooms, words, CORR_LIMIT, distRatio, pnpType,
+                              INDEX_MIN_POINTS, loadThreads);
+      std::vector<double> latencies;
+      int numSuccesses = 0;
+      long numInliers = 0;
+      long numIterations = 0;
+      for (size_t i = 0; i < queries.size(); i++) {
+        PoseStats stats;
+        auto begin = std::chrono::steady_clock::now();
+        Transform pose = perspective.localize(
+            exactWordIds[i], queryKeyPoints[i], queries[i],
+            queryImages[i]->getCameraModel(), roomIds[i], &stats);
+        auto end = std::chrono::steady_clock::now();
+        latencies.emplace_back(
+            std::chrono::duration<double, std::milli>(end - begin).count());
+        if (!pose.isNull()) {
+          numSuccesses++;
+          numInliers += stats.inliers;
+        }
+        numIterations += stats.iterations;
+      }
+      std::sort(latencies.begin(), latencies.end());
+
+      // iterations are 0 for types that don't report them
+      std::cout << std::left << std::setw(8) << pnpType << std::setw(12)
+                << std::fixed << std::setprecision(4)
+                << static_cast<double>(numSuccesses) / queries.size()
+                << std::setw(12) << std::setprecision(1)
+                << static_cast<double>(numInliers) / std::max(numSuccesses, 1)
+                << std::setw(12)
+                << static_cast<double>(numIterations) / queries.size()
+                << std::setw(12) << std::setprecision(3)
+                << percentile(latencies, 50) << std::setw(12)
+                << percentile(latencies, 99) << std::endl;
+    }
+  }
+
+  if (!stressThreads.empty() && !queries.empty()) {
+    AnnParams params = annParams;
+    params.type = annTypes.empty() ? ANN_TYPE : annTypes.front();
+    params.numThreads = loadThreads;
+    WordSearch wordSearch(words, params);
+    RoomSearch roomSearch(rooms, words);
+    Perspective perspective(rooms, words, CORR_LIMIT, distRatio,
+                            pnpTypes.empty() ? PNP_TYPE : pnpTypes.front(),
+                            INDEX_MIN_POINTS, loadThreads);
+
+    // the whole image localization pipeline, as run does it per request
+    auto localize = [&](int i) {
+      const Image &image = *queryImages[i % queryImages.size()];
+      cv::Mat queryImage = image.getImage();
+      CameraModel camera = image.getCameraModel();
+      Utility::downsample(image.getImage(), image.getCameraModel(),
+                          maxResolution, queryImage, camera);
+      std::vector<cv::KeyPoint> keyPoints;
+      cv::Mat descriptors;
+      feature.extract(queryImage, keyPoints, descriptors);
+      std::vector<int> wordIds = wordSearch.search(descriptors);
+      int roomId = roomSearch.search(wordIds);
+      perspective.localize(wordIds, keyPoints, descriptors, camera, roomId);
+    };
+
+    const int numRequests = queryImages.size() * std::max(stressRounds, 1);
+    double baseThroughput = 0;
+    for (int numThreads : stressThreads) {
+      long startTime = Utility::getTime();
+      Utility::parallelFor(0, numRequests, numThreads, localize);
+      long time = std::max<long>(Utility::getTime() - startTime, 1);
+      double throughput = numRequests * 1000.0 / time;
+      if (baseThroughput == 0) {
+        baseThroughput = throughput;
+      }
+      std::cout << "Stress " << numThreads << " threads " << numRequests
+                << " images in " << time << " ms, " << std::fixed
+                << std::setprecision(1) << throughput << " images/s, "
+                << std::setprecision(2) << throughput / baseThroughput << "x"
+                << std::endl;
+    }
+  }
+
+  return 0;
+}
+
+void Bench::printInvalid(const std::vector<std::string> &opts) {
+  std::cerr << "invalid options: ";
+  for (const auto &opt : opts) {
+    std::cerr << opt << " ";
+  }
+  std::cerr << std::endl;
+}
+
+void Bench::printUsage(const po::options_description &desc) {
+  std::cout << "snaplink bench [command options] db_file..." << std::endl
+            << std::endl
+            << desc << std::endl;
+}
@@ -0,0 +1,122 @@
+#include "build/Build.h"
+#include "lib/adapter/artifact/Artifact.h"
+#include "lib/adapter/rtabmap/RTABMapAdapter.h"
+#include "lib/algo/WordSearch.h"
+#include "lib/util/Utility.h"
+#include <iostream>
+
+int Build::run(int argc, char *argv[]) {
+  // Parse arguments
+  std::string artifactPath;
+  float distRatio;
+  int clusterBatchSize;
+  int clusterChecks;
+  int loadThreads;
+  AnnParams annParams;
+  std::vector<std::string> dbFiles;
+
+  po::options_description visible("command options");
+  visible.add_options() // use comment to force new line using formater
+      ("help,h", "print help message") //
+      ("output,o", po::value<std::string>(&artifactPath)->required(),
+       "the artifact file to write") //
+      ("dist-ratio,d", po::value<float>(&distRatio)->default_value(0.7),
+       "distance ratio used to create words") //
+      ("cluster-batch", po::value<int>(&clusterBatchSize)->default_value(0),
+       "cluster words approximately in parallel, n descriptors at a time, "
+       "0 means exact clustering") //
+      ("cluster-checks", po::value<int>(&clusterChecks)->default_value(32),
+       "KD-tree leaves checked per descriptor in approximate clustering") //
+      ("load-threads", po::value<int>(&loadThreads)->default_value(0),
+       "threads used to read databases and create words, 0 means one per "
+       "core") //
+      ("ann", po::value<std::string>(&annParams.type)->default_value(ANN_TYPE),
+       "word index saved with the artifact: flann, hnsw or brute") //
+      ("ann-trees",
+       po::value<int>(&annParams.flannTrees)->default_value(FLANN_TREES),
+       "KD-trees in a flann word index") //
+      ("hnsw-m", po::value<int>(&annParams.hnswM)->default_value(HNSW_M),
+       "links per node in an hnsw word index") //
+      ("hnsw-ef-construction",
+       po::value<int>(&annParams.hnswEfConstruction)
+           ->default_value(HNSW_EF_CONSTRUCTION),
+       "candidates kept while building an hnsw word index");
+
+  po::options_description hidden;
+  hidden.add_options() // use comment to force new line using formater
+      ("dbfiles", po::value<std::vector<std::string>>(&dbFiles)
+                      ->multitoken()
+                      ->required(),
+       "database files");
+
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::positional_options_description pos;
+  pos.add("dbfiles", -1);
+
+  po::variables_map vm;
+  po::parsed_options parsed = po::command_line_parser(argc, argv)
+                                  .options(all)
+                                  .positional(pos)
+                                  .allow_unregistered()
+                                  .run();
+  po::store(parsed, vm);
+
+  // print invalid options
+  std::vector<std::string> unrecog =
+      collect_unrecognized(parsed.options, po::exclude_positional);
+  if (unrecog.size() > 0) {
+    printInvalid(unrecog);
+    printUsage(visible);
+    return 1;
+  }
+
+  if (vm.count("help")) {
+    printUsage(visible);
+    return 0;
+  }
+
+  // check whether required options exist after handling help
+  po::notify(vm);
+
+  // Run the program
+  long startTime = Utility::getTime();
+  std::set<std::string> dbPaths(dbFiles.begin(), dbFiles.end());
+  RTABMapAdapter adapter(distRatio, clusterBatchSize, clusterChecks,
+                         loadThreads);
+  if (!adapter.init(dbPaths)) {
+    std::cerr << "reading data failed";
+    return 1;
+  }
+
+  const WordStore &words = adapter.getWords();
+  const std::map<int, Room> &rooms = adapter.getRooms();
+  annParams.numThreads = loadThreads;
+  WordSearch wordSearch(words, annParams);
+
+  Artifact artifact(artifactPath, dbPaths, distRatio, clusterBatchSize,
+                    clusterChecks);
+  if (!artifact.save(words, rooms, wordSearch)) {
+    return 1;
+  }
+
+  long buildTime = Utility::getTime() - startTime;
+  std::cout << "Time build " << buildTime << " ms" << std::endl;
+
+  return 0;
+}
+
+void Build::printInvalid(const std::vector<std::string> &opts) {
+  std::cerr << "invalid options: ";
+  for (const auto &opt : opts) {
+    std::cerr << opt << " ";
+  }
+  std::cerr << std::endl;
+}
+
+void Build::printUsage(const po::options_description &desc) {
+  std::cout << "snaplink build [command options] db_file..." << std::endl
+            << std::endl
+            << desc << std::endl;
+}
@@ -218,7 +218,7 @@ void Widget::projectPoints() {
 /* Get all points in Labels table */
 bool Widget::getLabels(std::vector<cv::Point3f> &points,
                        std::vector<std::string> &labels) {
-  const std::map<int, std::vector<Label>> &dbLabels = _adapter.getLabels();
+  std::map<int, std::vector<Label>> dbLabels = _adapter.getLabels();
   if (dbLabels.size() != 1) {
     return false;
   }
@@ -3,7 +3,8 @@
 #include "lib/data/Image.h"
 #include "lib/data/Label.h"
 #include "lib/data/Room.h"
-#include "lib/data/Word.h"
+#include "lib/data/WordStore.h"
+#include <cstdint>
 #include <list>
 #include <map>
 #include <set>
@@ -20,9 +21,9 @@ public:
   virtual const std::map<int, std::map<int, Image>> &getImages() = 0;
 
   /**
-   * return: {word ID : word}
+   * return: all words, with dense word IDs
    */
-  virtual const std::map<int, Word> &getWords() = 0;
+  virtual const WordStore &getWords() = 0;
 
   /**
    * return: {room ID : room}
@@ -30,9 +31,21 @@ public:
   virtual const std::map<int, Room> &getRooms() = 0;
 
   /**
-   * return: {room ID : vector of labels}
+   * return: {room ID : vector of labels}, a copy since labels can be put
+   * concurrently
    */
-  virtual const std::map<int, std::vector<Label>> &getLabels() = 0;
+  virtual std::map<int, std::vector<Label>> getLabels() = 0;
+
+  /**
+   * return: {room ID : vector of labels}, and version is set to the version
+   * of exactly these labels
+   */
+  virtual std::map<int, std::vector<Label>> getLabels(uint64_t &version) = 0;
+
+  /**
+   * return: the version of the labels, which changes whenever a label is put
+   */
+  virtual uint64_t getLabelsVersion() = 0;
 
   virtual bool putLabel(int roomId, std::string, std::string, std::string,
                         std::string) = 0;
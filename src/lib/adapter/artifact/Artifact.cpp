@@ -0,0 +1,442 @@
+#include "lib/adapter/artifact/Artifact.h"
+#include "lib/algo/WordSearch.h"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sqlite3.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+const char MAGIC[8] = {'S', 'N', 'A', 'P', 'L', 'I', 'N', 'K'};
+const size_t ALIGNMENT = 64;
+
+// all sections that follow the header and the database table are aligned to
+// ALIGNMENT bytes, in the order they are written in Artifact::save()
+struct Header {
+  char magic[8];
+  uint32_t version;
+  float distRatio;
+  int32_t clusterBatchSize;
+  int32_t clusterChecks;
+  int32_t descType;
+  int32_t descDim;
+  uint32_t numDbs;
+  uint32_t numRooms;
+  uint64_t numWords;
+  uint64_t numEntries; // (word, room) pairs
+  uint64_t numPoints;
+  uint64_t numRoomWords;
+};
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void pad(std::ostream &out) {
+  static const char zeros[ALIGNMENT] = {0};
+  size_t pos = static_cast<size_t>(out.tellp());
+  size_t rem = pos % ALIGNMENT;
+  if (rem != 0) {
+    out.write(zeros, ALIGNMENT - rem);
+  }
+}
+
+template <class T>
+void writeSection(std::ostream &out, const T *data, size_t count) {
+  pad(out);
+  out.write(reinterpret_cast<const char *>(data), count * sizeof(T));
+}
+
+template <class T>
+void writeSection(std::ostream &out, const std::vector<T> &v) {
+  writeSection(out, v.data(), v.size());
+}
+
+template <class T> void writeSection(std::ostream &out, Span<const T> span) {
+  writeSection(out, span.data(), span.size());
+}
+
+void writeRows(std::ostream &out, const cv::Mat &mat, size_t rowSize) {
+  pad(out);
+  for (int i = 0; i < mat.rows; i++) {
+    out.write(mat.ptr<char>(i), rowSize);
+  }
+}
+
+// return a pointer to count elements of T at the next aligned offset, or
+// nullptr if the mapping is too short
+template <class T>
+const T *readSection(const char *data, size_t size, size_t &offset,
+                     size_t count) {
+  offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  if (offset > size || count * sizeof(T) > size - offset) {
+    return nullptr;
+  }
+  const T *section = reinterpret_cast<const T *>(data + offset);
+  offset += count * sizeof(T);
+  return section;
+}
+
+// whether offsets[0..count] start at 0, never decrease, and end at end, so
+// that the ranges they delimit are within an array of end elements
+bool isOffsets(const uint64_t *offsets, size_t count, uint64_t end) {
+  if (offsets[0] != 0 || offsets[count] != end) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// modification time in nanoseconds, or -1 if the file does not exist
+long long modifiedTime(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return -1;
+  }
+  return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+} // namespace
+
+Artifact::Artifact(const std::string &path,
+                   const std::set<std::string> &dbPaths, float distRatio,
+                   int clusterBatchSize, int clusterChecks)
+    : _path(path), _dbPaths(dbPaths.begin(), dbPaths.end()),
+      _distRatio(distRatio), _clusterBatchSize(std::max(clusterBatchSize, 0)),
+      _clusterChecks(clusterBatchSize > 0 ? clusterChecks : 0),
+      _data(nullptr), _size(0) {}
+
+Artifact::~Artifact() { unmap(); }
+
+std::string Artifact::getIndexPath(const std::string &annType) const {
+  return _path + "." + annType + ".index";
+}
+
+bool Artifact::hasIndex(const std::string &annType) const {
+  long long artifactTime = modifiedTime(_path);
+  return artifactTime >= 0 &&
+         modifiedTime(getIndexPath(annType)) >= artifactTime;
+}
+
+bool Artifact::load(WordStore &words, std::map<int, Room> &rooms) {
+  unmap();
+
+  int fd = open(_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "artifact " << _path << " does not exist" << std::endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<long>(sizeof(Header))) {
+    std::cerr << "artifact " << _path << " is invalid" << std::endl;
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "could not map artifact " << _path << std::endl;
+    return false;
+  }
+  _data = data;
+  _size = st.st_size;
+
+  const char *bytes = static_cast<const char *>(_data);
+  Header header;
+  memcpy(&header, bytes, sizeof(Header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != ARTIFACT_VERSION) {
+    std::cerr << "artifact " << _path << " is of an unknown version"
+              << std::endl;
+    unmap();
+    return false;
+  }
+  if (header.distRatio != _distRatio) {
+    std::cerr << "artifact " << _path << " was built with distance ratio "
+              << header.distRatio << std::endl;
+    unmap();
+    return false;
+  }
+  if (header.clusterBatchSize != _clusterBatchSize ||
+      header.clusterChecks != _clusterChecks) {
+    std::cerr << "artifact " << _path << " was built with cluster batch "
+              << header.clusterBatchSize << " and cluster checks "
+              << header.clusterChecks << std::endl;
+    unmap();
+    return false;
+  }
+  if (header.numDbs != _dbPaths.size()) {
+    std::cerr << "artifact " << _path << " was built from other databases"
+              << std::endl;
+    unmap();
+    return false;
+  }
+
+  // database table
+  size_t offset = sizeof(Header);
+  const std::vector<uint64_t> &checksums = getChecksums();
+  for (unsigned int i = 0; i < header.numDbs; i++) {
+    uint64_t checksum;
+    uint32_t pathLen;
+    if (_size - offset < sizeof(checksum) + sizeof(pathLen)) {
+      unmap();
+      return false;
+    }
+    memcpy(&checksum, bytes + offset, sizeof(checksum));
+    offset += sizeof(checksum);
+    memcpy(&pathLen, bytes + offset, sizeof(pathLen));
+    offset += sizeof(pathLen);
+    if (_size - offset < pathLen) {
+      unmap();
+      return false;
+    }
+    std::string dbPath(bytes + offset, pathLen);
+    offset += pathLen;
+    if (dbPath != _dbPaths[i] || checksum != checksums[i]) {
+      std::cerr << "database " << _dbPaths[i] << " changed since artifact "
+                << _path << " was built" << std::endl;
+      unmap();
+      return false;
+    }
+  }
+
+  // the values in the sections are trusted from here on, so the sizes of the
+  // sections must not overflow
+  if (header.descType != CV_32F || header.descDim <= 0 ||
+      static_cast<size_t>(header.descDim) > _size ||
+      header.numWords > INT_MAX || header.numEntries > _size ||
+      header.numPoints > INT_MAX || header.numRoomWords > _size) {
+    std::cerr << "artifact " << _path << " is invalid" << std::endl;
+    unmap();
+    return false;
+  }
+  const size_t descSize = header.descDim * CV_ELEM_SIZE(header.descType);
+  if (header.numWords > _size / descSize ||
+      header.numPoints > _size / descSize) {
+    std::cerr << "artifact " << _path << " is truncated" << std::endl;
+    unmap();
+    return false;
+  }
+
+  // sections
+  const uint64_t *wordEntryOffsets =
+      readSection<uint64_t>(bytes, _size, offset, header.numWords + 1);
+  const int32_t *entryRoomIds =
+      readSection<int32_t>(bytes, _size, offset, header.numEntries);
+  const uint64_t *entryPointOffsets =
+      readSection<uint64_t>(bytes, _size, offset, header.numEntries + 1);
+  const char *meanDescriptors =
+      readSection<char>(bytes, _size, offset, header.numWords * descSize);
+  const cv::Point3f *points3 =
+      readSection<cv::Point3f>(bytes, _size, offset, header.numPoints);
+  const char *descriptors =
+      readSection<char>(bytes, _size, offset, header.numPoints * descSize);
+  const int32_t *roomIds =
+      readSection<int32_t>(bytes, _size, offset, header.numRooms);
+  const uint64_t *roomWordOffsets =
+      readSection<uint64_t>(bytes, _size, offset, header.numRooms + 1);
+  const int32_t *roomWordIds =
+      readSection<int32_t>(bytes, _size, offset, header.numRoomWords);
+  if (wordEntryOffsets == nullptr || entryRoomIds == nullptr ||
+      entryPointOffsets == nullptr || meanDescriptors == nullptr ||
+      points3 == nullptr || descriptors == nullptr || roomIds == nullptr ||
+      roomWordOffsets == nullptr || roomWordIds == nullptr) {
+    std::cerr << "artifact " << _path << " is truncated" << std::endl;
+    unmap();
+    return false;
+  }
+
+  // offsets and IDs index the other sections without checks
+  bool isValid =
+      isOffsets(wordEntryOffsets, header.numWords, header.numEntries) &&
+      isOffsets(entryPointOffsets, header.numEntries, header.numPoints) &&
+      isOffsets(roomWordOffsets, header.numRooms, header.numRoomWords);
+  std::set<int32_t> roomIdSet(roomIds, roomIds + header.numRooms);
+  for (uint64_t e = 0; isValid && e < header.numEntries; e++) {
+    isValid = roomIdSet.count(entryRoomIds[e]) > 0;
+  }
+  for (uint64_t i = 0; isValid && i < header.numRoomWords; i++) {
+    isValid = roomWordIds[i] >= 0 &&
+              static_cast<uint64_t>(roomWordIds[i]) < header.numWords;
+  }
+  if (!isValid) {
+    std::cerr << "artifact " << _path << " is corrupt" << std::endl;
+    unmap();
+    return false;
+  }
+
+  words = WordStore(
+      Span<const uint64_t>(wordEntryOffsets, header.numWords + 1),
+      Span<const int32_t>(entryRoomIds, header.numEntries),
+      Span<const uint64_t>(entryPointOffsets, header.numEntries + 1),
+      Span<const cv::Point3f>(points3, header.numPoints),
+      cv::Mat(header.numWords, header.descDim, header.descType,
+              const_cast<char *>(meanDescriptors)),
+      cv::Mat(header.numPoints, header.descDim, header.descType,
+              const_cast<char *>(descriptors)));
+
+  rooms.clear();
+  for (uint32_t r = 0; r < header.numRooms; r++) {
+    Room room(roomIds[r]);
+    room.addWordIds(std::vector<int>(roomWordIds + roomWordOffsets[r],
+                                     roomWordIds + roomWordOffsets[r + 1]));
+    rooms.emplace(roomIds[r], std::move(room));
+  }
+
+  std::cerr << "loaded " << words.getNumWords() << " words and "
+            << rooms.size() << " rooms from artifact " << _path << std::endl;
+  return true;
+}
+
+bool Artifact::save(const WordStore &words, const std::map<int, Room> &rooms,
+                    const WordSearch &wordSearch) {
+  assert(words.getNumWords() > 0);
+
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = ARTIFACT_VERSION;
+  header.distRatio = _distRatio;
+  header.clusterBatchSize = _clusterBatchSize;
+  header.clusterChecks = _clusterChecks;
+  header.descType = words.getDescType();
+  header.descDim = words.getDescDim();
+  header.numDbs = _dbPaths.size();
+  header.numRooms = rooms.size();
+  header.numWords = words.getNumWords();
+  header.numEntries = words.getNumEntries();
+  header.numPoints = words.getNumPoints();
+  const size_t descSize = header.descDim * CV_ELEM_SIZE(header.descType);
+
+  std::vector<int32_t> roomIds;
+  std::vector<uint64_t> roomWordOffsets(1, 0);
+  std::vector<int32_t> roomWordIds;
+  for (const auto &room : rooms) {
+    roomIds.emplace_back(room.first);
+    const std::set<int> &ids = room.second.getWordIds();
+    roomWordIds.insert(roomWordIds.end(), ids.begin(), ids.end());
+    roomWordOffsets.emplace_back(roomWordIds.size());
+  }
+  header.numRoomWords = roomWordIds.size();
+
+  std::string tmpPath = _path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cerr << "could not write artifact " << tmpPath << std::endl;
+    return false;
+  }
+  out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  const std::vector<uint64_t> &checksums = getChecksums();
+  for (unsigned int i = 0; i < _dbPaths.size(); i++) {
+    uint32_t pathLen = _dbPaths[i].size();
+    out.write(reinterpret_cast<const char *>(&checksums[i]),
+              sizeof(checksums[i]));
+    out.write(reinterpret_cast<const char *>(&pathLen), sizeof(pathLen));
+    out.write(_dbPaths[i].data(), pathLen);
+  }
+  writeSection(out, words.getWordEntryOffsets());
+  writeSection(out, words.getEntryRoomIds());
+  writeSection(out, words.getEntryPointOffsets());
+  writeRows(out, words.getMeanDescriptors(), descSize);
+  writeSection(out, words.getPoints3());
+  writeRows(out, words.getDescriptors(), descSize);
+  writeSection(out, roomIds);
+  writeSection(out, roomWordOffsets);
+  writeSection(out, roomWordIds);
+  out.close();
+  if (!out || std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+    std::cerr << "could not write artifact " << _path << std::endl;
+    return false;
+  }
+
+  std::cerr << "saved " << words.getNumWords() << " words and "
+            << rooms.size() << " rooms to artifact " << _path << std::endl;
+
+  // the index is written after the artifact, so it is not older than it
+  return saveIndex(wordSearch);
+}
+
+bool Artifact::saveIndex(const WordSearch &wordSearch) {
+  std::string indexPath = getIndexPath(wordSearch.getAnnType());
+  std::string tmpPath = indexPath + ".tmp";
+  if (!wordSearch.saveIndex(tmpPath) ||
+      std::rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+    std::cerr << "could not write word index " << indexPath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+uint64_t Artifact::checksumDb(const std::string &dbPath) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(dbPath.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    std::cerr << "Could not open database " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_close(db);
+    return 0;
+  }
+
+  // images, depths, calibrations, poses and links words are created from
+  const std::vector<std::string> tables = {"Node", "Link", "Data"};
+  for (const auto &table : tables) {
+    hash = fnv1a(hash, table.data(), table.size());
+
+    sqlite3_stmt *stmt = nullptr;
+    std::string sql = "SELECT * FROM " + table + " ORDER BY rowid";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+      sqlite3_finalize(stmt);
+      continue;
+    }
+    int numCols = sqlite3_column_count(stmt);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      for (int i = 0; i < numCols; i++) {
+        int type = sqlite3_column_type(stmt, i);
+        hash = fnv1a(hash, &type, sizeof(type));
+        const void *blob = sqlite3_column_blob(stmt, i);
+        int size = sqlite3_column_bytes(stmt, i);
+        if (blob != nullptr && size > 0) {
+          hash = fnv1a(hash, blob, size);
+        }
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  sqlite3_close(db);
+  return hash;
+}
+
+const std::vector<uint64_t> &Artifact::getChecksums() {
+  if (_checksums.empty()) {
+    for (const auto &dbPath : _dbPaths) {
+      _checksums.emplace_back(checksumDb(dbPath));
+    }
+  }
+  return _checksums;
+}
+
+void Artifact::unmap() {
+  if (_data != nullptr) {
+    munmap(_data, _size);
+    _data = nullptr;
+    _size = 0;
+  }
+}
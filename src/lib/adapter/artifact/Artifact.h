@@ -0,0 +1,80 @@
+#pragma once
+
+#include "lib/data/Room.h"
+#include "lib/data/WordStore.h"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define ARTIFACT_VERSION 5
+
+class WordSearch;
+
+/**
+ * A versioned binary file holding the words and rooms created from a set of
+ * databases, so they don't need to be rebuilt on every start. The artifact is
+ * memory-mapped when loaded, and the loaded word store is a view of the
+ * mapping, so an artifact must outlive the words it loads.
+ *
+ * Word indexes are saved next to it, one per ANN type, e.g. path.hnsw.index.
+ * An index is valid if it is not older than the artifact, and each index
+ * checks on load that it was built with the current parameters.
+ */
+class Artifact final {
+public:
+  /**
+   * clusterBatchSize and clusterChecks are those words are clustered with,
+   * see WordCluster
+   */
+  explicit Artifact(const std::string &path,
+                    const std::set<std::string> &dbPaths, float distRatio,
+                    int clusterBatchSize, int clusterChecks);
+  ~Artifact();
+
+  Artifact(const Artifact &) = delete;
+  Artifact &operator=(const Artifact &) = delete;
+
+  /**
+   * return false if the artifact does not exist, is of another version, or
+   * was built from other databases or with another distance ratio or
+   * clustering
+   */
+  bool load(WordStore &words, std::map<int, Room> &rooms);
+
+  bool save(const WordStore &words, const std::map<int, Room> &rooms,
+            const WordSearch &wordSearch);
+
+  /**
+   * write the word index of wordSearch next to the artifact
+   */
+  bool saveIndex(const WordSearch &wordSearch);
+
+  std::string getIndexPath(const std::string &annType) const;
+
+  /**
+   * return true if an index of the type was saved after the artifact
+   */
+  bool hasIndex(const std::string &annType) const;
+
+  /**
+   * checksum of the database tables words are created from, so that labels
+   * and AprilTag poses written to a database do not invalidate the artifact
+   */
+  static uint64_t checksumDb(const std::string &dbPath);
+
+private:
+  const std::vector<uint64_t> &getChecksums();
+  void unmap();
+
+private:
+  std::string _path;
+  std::vector<std::string> _dbPaths;
+  std::vector<uint64_t> _checksums;
+  float _distRatio;
+  int _clusterBatchSize;
+  int _clusterChecks; // 0 for exact clustering, which does not check leaves
+  void *_data;
+  size_t _size;
+};
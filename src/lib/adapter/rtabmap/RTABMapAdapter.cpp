@@ -3,8 +3,10 @@
 #include "lib/algo/WordCluster.h"
 #include "lib/data/Room.h"
 #include "lib/data/Transform.h"
-#include "lib/data/Word.h"
+#include "lib/data/WordStore.h"
 #include "lib/util/Utility.h"
+#include <algorithm>
+#include <atomic>
 #include <opencv2/xfeatures2d.hpp>
 #include <pcl/common/centroid.h>
 #include <pcl/common/common.h>
@@ -21,47 +23,63 @@
 #include <sqlite3.h>
 #include <utility>
 
-RTABMapAdapter::RTABMapAdapter(float distRatio)
-    : _nextImageId(0), _distRatio(distRatio) {}
+RTABMapAdapter::RTABMapAdapter(float distRatio, int clusterBatchSize,
+                               int clusterChecks, int numThreads)
+    : _nextImageId(0), _distRatio(distRatio),
+      _clusterBatchSize(clusterBatchSize), _clusterChecks(clusterChecks),
+      _numThreads(numThreads), _labelsVersion(Utility::getTime()) {}
 
 bool RTABMapAdapter::init(const std::set<std::string> &dbPaths) {
-  Apriltag aprilTag(0.16);
-  int roomId = 0;
-  for (const auto &dbPath : dbPaths) {
-    // a room is a DB (for now)
-    auto roomImages = readRoomImages(dbPath, roomId);
-    _images.emplace(roomId, std::move(roomImages));
-
-    auto roomLabels = readRoomLabels(dbPath, roomId);
-    _labels.emplace(roomId, std::move(roomLabels));
-
-    _roomPaths.emplace(roomId, std::string(dbPath));
-
-    createAprilTagPoseTable(roomId);
-    createAprilTagMap(dbPath, roomId);
-
-    if (_aprilTagMapPro[roomId].empty()) {
-      std::cout << "AprilTagMapPro is empty\n";
-      for (std::map<int, Image>::iterator it = _images[roomId].begin();
-           it != _images[roomId].end(); ++it) {
-        Image image = it->second;
-        std::pair<std::vector<int>, std::vector<Transform>>
-            aprilTagDetectResults =
-                aprilTag.aprilDetect(image.getImage(), image.getCameraModel());
-        for (unsigned int i = 0; i < aprilTagDetectResults.first.size(); i++) {
-          std::cout << "Detected aprilTag\n";
-          int code = aprilTagDetectResults.first[i];
-          Transform tagPoseInModelFrame =
-              image.getPose() * aprilTagDetectResults.second[i];
-          saveAprilTagPose(roomId, Utility::getTime(), code,
-                           tagPoseInModelFrame, 0);
-        }
-      }
-    }
+  // a room is a DB (for now), room IDs follow the order of paths no matter
+  // which database finishes loading first
+  std::vector<std::string> paths(dbPaths.begin(), dbPaths.end());
+  int numRooms = paths.size();
+  for (int roomId = 0; roomId < numRooms; roomId++) {
+    _roomPaths.emplace(roomId, paths[roomId]);
+    _labels.emplace(roomId, std::vector<Label>());
+  }
 
-    roomId++;
+  std::vector<std::map<int, Image>> sigImages(numRooms);
+  std::vector<long> loadTimes(numRooms, 0);
+  Utility::parallelFor(0, numRooms, _numThreads, [&](int roomId) {
+    long startTime = Utility::getTime();
+    sigImages[roomId] = readRoomImages(paths[roomId], roomId);
+    loadTimes[roomId] += Utility::getTime() - startTime;
+  });
+
+  // image IDs are assigned in room order, so they are stable as well
+  for (int roomId = 0; roomId < numRooms; roomId++) {
+    auto &images = _images[roomId];
+    for (const auto &sigImage : sigImages[roomId]) {
+      int sigId = sigImage.first;
+      const Image &image = sigImage.second;
+      int imageId = _nextImageId;
+      _nextImageId++;
+      images.emplace(imageId, Image(imageId, roomId, image.getImage(),
+                                    image.getDepth(), image.getPose(),
+                                    image.getCameraModel()));
+      _sigImageIdMap[roomId][sigId] = imageId;
+      _imageSigIdMap[roomId][imageId] = sigId;
+    }
+  }
+  sigImages.clear();
+
+  // images and ID maps are only read from here on
+  Utility::parallelFor(0, numRooms, _numThreads, [&](int roomId) {
+    long startTime = Utility::getTime();
+    _labels.at(roomId) = readRoomLabels(paths[roomId], roomId);
+
+    sqlite3_close(createAprilTagPoseTable(roomId));
+    createAprilTagMap(paths[roomId], roomId);
+    detectAprilTags(roomId);
+    loadTimes[roomId] += Utility::getTime() - startTime;
+  });
+
+  for (int roomId = 0; roomId < numRooms; roomId++) {
+    std::cout << "Time reading database " << paths[roomId] << ": "
+              << loadTimes[roomId] << " ms" << std::endl;
   }
-  _dbCounts = roomId;
+  _dbCounts = numRooms;
 
   return true;
 }
@@ -70,16 +88,16 @@ const std::map<int, std::map<int, Image>> &RTABMapAdapter::getImages() {
   return _images;
 }
 
-const std::map<int, Word> &RTABMapAdapter::getWords() {
+const WordStore &RTABMapAdapter::getWords() {
   // create words the first time it's accessed
-  if (_words.empty()) {
+  if (_words.getNumWords() == 0) {
     createWords();
   }
   return _words;
 }
 
 const std::map<int, Room> &RTABMapAdapter::getRooms() {
-  if (_words.empty()) {
+  if (_words.getNumWords() == 0) {
     createWords();
   }
   // create rooms the first time it's accessed
@@ -89,10 +107,23 @@ const std::map<int, Room> &RTABMapAdapter::getRooms() {
   return _rooms;
 }
 
-const std::map<int, std::vector<Label>> &RTABMapAdapter::getLabels() {
+std::map<int, std::vector<Label>> RTABMapAdapter::getLabels() {
+  uint64_t version;
+  return getLabels(version);
+}
+
+std::map<int, std::vector<Label>>
+RTABMapAdapter::getLabels(uint64_t &version) {
+  std::lock_guard<std::mutex> lock(_labelsMutex);
+  version = _labelsVersion;
   return _labels;
 }
 
+uint64_t RTABMapAdapter::getLabelsVersion() {
+  std::lock_guard<std::mutex> lock(_labelsMutex);
+  return _labelsVersion;
+}
+
 std::map<int, Image> RTABMapAdapter::readRoomImages(const std::string &dbPath,
                                                     int roomId) {
   std::cerr << "reading images from database " << dbPath << std::endl;
@@ -159,12 +190,9 @@ std::map<int, Image> RTABMapAdapter::readRoomImages(const std::string &dbPath,
                 lt.r31(), lt.r32(), lt.r33(), lt.o34());
     pose = pose * t;
 
-    int imageId = _nextImageId;
-    _nextImageId++;
-    images.emplace(imageId, Image(imageId, roomId, image, depth, pose, camera));
-    // insert if not exists
-    _sigImageIdMap[roomId][sig->id()] = imageId;
-    _imageSigIdMap[roomId][imageId] = sig->id();
+    // image IDs are assigned by init()
+    images.emplace(sig->id(),
+                   Image(sig->id(), roomId, image, depth, pose, camera));
   }
 
   return images;
@@ -226,62 +254,114 @@ void RTABMapAdapter::createWords() {
 
   assert(_images.empty() == false);
 
-  rtabmap::VWDictionary vwd;
-  cv::Ptr<cv::xfeatures2d::SURF> detector = cv::xfeatures2d::SURF::create();
-
-  std::vector<int> roomIds;
-  std::vector<cv::Point3f> points3;
-  cv::Mat descriptors;
+  std::vector<const Image *> images;
   for (const auto &roomImages : _images) {
-    int roomId = roomImages.first;
     for (const auto &image : roomImages.second) {
-      // compute 2D features
-      std::vector<cv::KeyPoint> imgKeyPoints;
-      cv::Mat imgDescriptors;
-      detector->detectAndCompute(image.second.getImage(), cv::Mat(),
-                                 imgKeyPoints, imgDescriptors);
-
-      for (unsigned int i = 0; i < imgKeyPoints.size(); i++) {
-        cv::KeyPoint kp = imgKeyPoints.at(i);
-        cv::Mat descriptor = imgDescriptors.row(i);
-        cv::Point3f point3;
-        if (Utility::getPoint3World(image.second, kp.pt, point3)) {
-          roomIds.emplace_back(roomId);
-          points3.emplace_back(point3);
-          descriptors.push_back(descriptor);
-        }
+      images.emplace_back(&image.second);
+    }
+  }
+
+  cv::Ptr<cv::xfeatures2d::SURF> surf = cv::xfeatures2d::SURF::create();
+  const int descSize = surf->descriptorSize();
+  const int descType = surf->descriptorType();
+
+  // every image writes to its own buffers, which are concatenated once
+  std::vector<std::vector<cv::Point3f>> imagePoints3(images.size());
+  std::vector<cv::Mat> imageDescriptors(images.size());
+  std::atomic<int> imageCount(0);
+  std::atomic<long> keyPointCount(0);
+  std::mutex progressMutex;
+  auto extract = [&](int i) {
+    // detectors are not shared between threads
+    cv::Ptr<cv::xfeatures2d::SURF> detector = cv::xfeatures2d::SURF::create();
+
+    // compute 2D features
+    const Image &image = *images[i];
+    std::vector<cv::KeyPoint> imgKeyPoints;
+    cv::Mat imgDescriptors;
+    detector->detectAndCompute(image.getImage(), cv::Mat(), imgKeyPoints,
+                               imgDescriptors);
+
+    std::vector<int> indices;
+    std::vector<cv::Point3f> &points3 = imagePoints3[i];
+    indices.reserve(imgKeyPoints.size());
+    points3.reserve(imgKeyPoints.size());
+    for (unsigned int j = 0; j < imgKeyPoints.size(); j++) {
+      cv::Point3f point3;
+      if (Utility::getPoint3World(image, imgKeyPoints[j].pt, point3)) {
+        indices.emplace_back(j);
+        points3.emplace_back(point3);
       }
     }
+
+    cv::Mat &descriptors = imageDescriptors[i];
+    descriptors.create(indices.size(), descSize, descType);
+    for (unsigned int j = 0; j < indices.size(); j++) {
+      imgDescriptors.row(indices[j]).copyTo(descriptors.row(j));
+    }
+
+    keyPointCount += imgKeyPoints.size();
+    int count = ++imageCount;
+    std::lock_guard<std::mutex> lock(progressMutex);
+    Utility::showProgress(static_cast<float>(count) / images.size());
+  };
+  long startTime = Utility::getTime();
+  Utility::parallelFor(0, static_cast<int>(images.size()), _numThreads,
+                       extract);
+  std::cout << std::endl;
+  long featureTime = Utility::getTime() - startTime;
+  std::cerr << "Time feature extraction " << featureTime << " ms, "
+            << keyPointCount << " keypoints in " << images.size()
+            << " images, "
+            << keyPointCount * 1000 / std::max(featureTime, 1L)
+            << " keypoints/s" << std::endl;
+
+  int numPoints = 0;
+  for (const auto &points3 : imagePoints3) {
+    numPoints += points3.size();
+  }
+  std::vector<int> roomIds;
+  std::vector<cv::Point3f> points3;
+  cv::Mat descriptors(numPoints, descSize, descType);
+  roomIds.reserve(numPoints);
+  points3.reserve(numPoints);
+  for (unsigned int i = 0; i < images.size(); i++) {
+    int begin = points3.size();
+    roomIds.insert(roomIds.end(), imagePoints3[i].size(),
+                   images[i]->getRoomId());
+    points3.insert(points3.end(), imagePoints3[i].begin(),
+                   imagePoints3[i].end());
+    imageDescriptors[i].copyTo(descriptors.rowRange(begin, points3.size()));
   }
+  imagePoints3.clear();
+  imageDescriptors.clear();
 
   // convert them to 3D points in words
-  WordCluster wordCluster(_distRatio);
+  startTime = Utility::getTime();
+  WordCluster wordCluster(_distRatio, _clusterBatchSize, _clusterChecks,
+                          _numThreads);
   _words = wordCluster.cluster(roomIds, points3, descriptors);
+  long clusterTime = Utility::getTime() - startTime;
+  std::cerr << "Time clustering " << clusterTime << " ms" << std::endl;
 
-  std::cerr << "total number of words: " << _words.size() << std::endl;
-  long count = 0;
-  for (const auto &word : _words) {
-    for (const auto &desc : word.second.getDescriptorsByDb()) {
-      count += desc.second.rows;
-    }
-  }
-  std::cerr << "total number of 3D points: " << count << std::endl;
+  std::cerr << "total number of words: " << _words.getNumWords() << std::endl;
+  std::cerr << "total number of 3D points: " << _words.getNumPoints()
+            << std::endl;
 }
 
 void RTABMapAdapter::createRooms() {
-  assert(_words.empty() == false);
-  for (const auto word : _words) {
-    int wordId = word.first;
-    for (const auto points : word.second.getPoints3Map()) {
-      int roomId = points.first;
-      auto iter = _rooms.find(roomId);
-      if (iter == _rooms.end()) {
-        auto ret = _rooms.emplace(roomId, Room(roomId));
-        iter = ret.first;
-      }
-      iter->second.addWordIds(std::vector<int>(1, wordId));
+  assert(_words.getNumWords() > 0);
+  std::map<int, std::vector<int>> roomWordIds;
+  for (int wordId = 0; wordId < _words.getNumWords(); wordId++) {
+    for (int roomId : _words.getRoomIds(wordId)) {
+      roomWordIds[roomId].emplace_back(wordId);
     }
   }
+  for (auto &wordIds : roomWordIds) {
+    int roomId = wordIds.first;
+    auto ret = _rooms.emplace(roomId, Room(roomId));
+    ret.first->second.addWordIds(std::move(wordIds.second));
+  }
 }
 
 sqlite3 *RTABMapAdapter::createLabelTable(int roomId) {
@@ -330,7 +410,9 @@ bool RTABMapAdapter::putLabel(int roomId, std::string label_name,
     sqlite3_close(labelDB);
     if (rc == SQLITE_OK) {
       Label newLabel(roomId, point3, label_name);
+      std::lock_guard<std::mutex> lock(_labelsMutex);
       _labels.at(roomId).push_back(newLabel);
+      _labelsVersion++;
     }
     return rc == SQLITE_OK;
   } else {
@@ -449,6 +531,7 @@ void RTABMapAdapter::createAprilTagMap(std::string dbPath, int roomId) {
       double z = sqlite3_column_double(stmt, 13);
       double error = sqlite3_column_int(stmt, 14);
       Transform pose(r11, r12, r13, x, r21, r22, r23, y, r31, r32, r33, z);
+      std::lock_guard<std::mutex> lock(_aprilTagMapMutex);
       if (error == 0) {
         if (_aprilTagMapPro.count(code) > 0) {
           _aprilTagMapPro[code].emplace(roomId, pose);
@@ -476,6 +559,36 @@ void RTABMapAdapter::createAprilTagMap(std::string dbPath, int roomId) {
   sqlite3_close(db);
 }
 
+void RTABMapAdapter::detectAprilTags(int roomId) {
+  // the map is keyed by tag code. The poses of this room were read from its
+  // own database just before, so other rooms loading concurrently do not
+  // change the outcome.
+  {
+    std::lock_guard<std::mutex> lock(_aprilTagMapMutex);
+    for (const auto &codePoses : _aprilTagMapPro) {
+      if (codePoses.second.count(roomId) > 0) {
+        return;
+      }
+    }
+  }
+
+  std::cout << "AprilTagMapPro has no tags of room " << roomId << "\n";
+  Apriltag aprilTag(0.16);
+  for (const auto &roomImage : _images.at(roomId)) {
+    const Image &image = roomImage.second;
+    std::pair<std::vector<int>, std::vector<Transform>> aprilTagDetectResults =
+        aprilTag.aprilDetect(image.getImage(), image.getCameraModel());
+    for (unsigned int i = 0; i < aprilTagDetectResults.first.size(); i++) {
+      std::cout << "Detected aprilTag\n";
+      int code = aprilTagDetectResults.first[i];
+      Transform tagPoseInModelFrame =
+          image.getPose() * aprilTagDetectResults.second[i];
+      saveAprilTagPose(roomId, Utility::getTime(), code, tagPoseInModelFrame,
+                       0);
+    }
+  }
+}
+
 std::pair<int, Transform> RTABMapAdapter::lookupAprilCode(int code) {
   std::multimap<int, Transform> value;
   {
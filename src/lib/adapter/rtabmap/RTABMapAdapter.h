@@ -1,6 +1,7 @@
 #pragma once
 
 #include "lib/adapter/Adapter.h"
+#include "lib/algo/WordCluster.h"
 #include <list>
 #include <map>
 #include <memory>
@@ -18,14 +19,19 @@
 
 class RTABMapAdapter final : public Adapter {
 public:
-  explicit RTABMapAdapter(float distRatio = DIST_RATIO);
+  explicit RTABMapAdapter(float distRatio = DIST_RATIO,
+                          int clusterBatchSize = CLUSTER_BATCH_SIZE,
+                          int clusterChecks = CLUSTER_CHECKS,
+                          int numThreads = 0);
 
-  // read data from database files
+  // read data from database files, numThreads databases at a time
   bool init(const std::set<std::string> &dbPaths) final;
   const std::map<int, std::map<int, Image>> &getImages() final;
-  const std::map<int, Word> &getWords() final;
+  const WordStore &getWords() final;
   const std::map<int, Room> &getRooms() final;
-  const std::map<int, std::vector<Label>> &getLabels() final;
+  std::map<int, std::vector<Label>> getLabels() final;
+  std::map<int, std::vector<Label>> getLabels(uint64_t &version) final;
+  uint64_t getLabelsVersion() final;
   bool putLabel(int roomId, std::string label_name, std::string label_id,
                 std::string label_x, std::string label_y) final;
   bool saveAprilTagPose(int roomId, long time, int code,
@@ -35,6 +41,9 @@ public:
   std::vector<std::pair<int, Transform>> lookupAprilCodes(std::vector<int> codes);
   int getDBCounts();
 private:
+  /**
+   * return: {signature ID : image}
+   */
   std::map<int, Image> readRoomImages(const std::string &dbPath, int roomId);
   std::vector<Label> readRoomLabels(const std::string &dbPath, int roomId);
 
@@ -42,9 +51,13 @@ private:
   void createWords();
   void createRooms();
   sqlite3 *createAprilTagPoseTable(int roomId);
+  void detectAprilTags(int roomId);
 private:
   int _nextImageId;
   float _distRatio;
+  int _clusterBatchSize;
+  int _clusterChecks;
+  int _numThreads;
   // {room ID : {signature ID in database : image ID in memory}}
   std::map<int, std::map<int, int>> _sigImageIdMap;
   // {room ID : {image ID in memory : signature ID in database}}
@@ -53,9 +66,14 @@ private:
   // {tag Code: {room ID in memory: tag pose in room model}}
   std::map<int, std::multimap<int, Transform>> _aprilTagMap;
   std::map<int, std::multimap<int, Transform>> _aprilTagMapPro;
-  std::map<int, Word> _words;
+  WordStore _words;
   std::map<int, Room> _rooms;
+  // guards the labels and their version once init returns
+  std::mutex _labelsMutex;
   std::map<int, std::vector<Label>> _labels;
+  // starts at the launch time in ms, so that a client never mistakes the
+  // labels of a restarted server for those it got before
+  uint64_t _labelsVersion;
   std::map<int, std::string> _roomPaths;
   sqlite3 *_labelDB;
   std::string _labelPath;
@@ -1,34 +1,182 @@
 #include "lib/algo/Feature.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
 
-Feature::Feature(int sampleSize) : _sampleSize(sampleSize) {
-  int minHessian = 400;
-  _detector = cv::xfeatures2d::SURF::create(minHessian);
+namespace {
+const int MIN_HESSIAN = 400;
+
+// detectors are not documented as thread safe, so they are not shared
+cv::xfeatures2d::SURF &getDetector() {
+  thread_local cv::Ptr<cv::xfeatures2d::SURF> detector =
+      cv::xfeatures2d::SURF::create(MIN_HESSIAN);
+  return *detector;
+}
+
+// descriptors are not computed if they are nullptr
+void detectAndCompute(const cv::Mat &image,
+                      std::vector<cv::KeyPoint> &keyPoints,
+                      cv::Mat *descriptors) {
+  if (descriptors != nullptr) {
+    getDetector().detectAndCompute(image, cv::Mat(), keyPoints, *descriptors);
+  } else {
+    getDetector().detect(image, keyPoints);
+  }
 }
+} // namespace
+
+Feature::Feature(int sampleSize, int numThreads)
+    : _sampleSize(sampleSize), _numThreads(numThreads) {}
 
 void Feature::extract(const cv::Mat &image,
                       std::vector<cv::KeyPoint> &keyPoints,
                       cv::Mat &descriptors) const {
-  _detector->detectAndCompute(image, cv::Mat(), keyPoints, descriptors);
-  if (_sampleSize != 0) {
-    subsample(keyPoints, descriptors);
+  if (_sampleSize <= 0) {
+    extractTiles(image, keyPoints, &descriptors);
+    return;
+  }
+
+  // describe only the keypoints within the budget
+  extractTiles(image, keyPoints, nullptr);
+  selectKeyPoints(image.size(), keyPoints);
+  if (keyPoints.empty()) {
+    descriptors.release();
+    return;
+  }
+  getDetector().compute(image, keyPoints, descriptors);
+}
+
+void Feature::extractTiles(const cv::Mat &image,
+                           std::vector<cv::KeyPoint> &keyPoints,
+                           cv::Mat *descriptors) const {
+  // about one tile per thread, each at least twice as large as the overlap
+  int rows = std::max(1, static_cast<int>(std::sqrt(_numThreads)));
+  int cols = (_numThreads + rows - 1) / rows;
+  rows = std::max(1, std::min(rows, image.rows / (2 * TILE_OVERLAP)));
+  cols = std::max(1, std::min(cols, image.cols / (2 * TILE_OVERLAP)));
+  const int numTiles = rows * cols;
+  if (numTiles == 1) {
+    detectAndCompute(image, keyPoints, descriptors);
+    return;
+  }
+
+  std::vector<std::vector<cv::KeyPoint>> tileKeyPoints(numTiles);
+  std::vector<cv::Mat> tileDescriptors(numTiles);
+  auto extractTile = [&](int t) {
+    int row = t / cols;
+    int col = t % cols;
+    cv::Rect core(col * image.cols / cols, row * image.rows / rows, 0, 0);
+    core.width = (col + 1) * image.cols / cols - core.x;
+    core.height = (row + 1) * image.rows / rows - core.y;
+    cv::Rect roi(core.x - TILE_OVERLAP, core.y - TILE_OVERLAP,
+                 core.width + 2 * TILE_OVERLAP, core.height + 2 * TILE_OVERLAP);
+    roi &= cv::Rect(0, 0, image.cols, image.rows);
+
+    std::vector<cv::KeyPoint> roiKeyPoints;
+    cv::Mat roiDescriptors;
+    detectAndCompute(image(roi), roiKeyPoints,
+                     descriptors != nullptr ? &roiDescriptors : nullptr);
+
+    // keep the keypoints in the core, in image coordinates
+    std::vector<int> kept;
+    for (size_t i = 0; i < roiKeyPoints.size(); i++) {
+      cv::Point2f &pt = roiKeyPoints[i].pt;
+      pt.x += roi.x;
+      pt.y += roi.y;
+      if (pt.x >= core.x && pt.x < core.x + core.width && pt.y >= core.y &&
+          pt.y < core.y + core.height) {
+        kept.emplace_back(i);
+      }
+    }
+    for (int i : kept) {
+      tileKeyPoints[t].emplace_back(roiKeyPoints[i]);
+    }
+    if (descriptors != nullptr && !kept.empty()) {
+      tileDescriptors[t].create(kept.size(), roiDescriptors.cols,
+                                roiDescriptors.type());
+      for (size_t i = 0; i < kept.size(); i++) {
+        roiDescriptors.row(kept[i]).copyTo(tileDescriptors[t].row(i));
+      }
+    }
+  };
+  Utility::parallelFor(0, numTiles, _numThreads, extractTile);
+
+  keyPoints.clear();
+  std::vector<cv::Mat> nonEmpty;
+  for (int t = 0; t < numTiles; t++) {
+    keyPoints.insert(keyPoints.end(), tileKeyPoints[t].begin(),
+                     tileKeyPoints[t].end());
+    if (!tileDescriptors[t].empty()) {
+      nonEmpty.emplace_back(tileDescriptors[t]);
+    }
+  }
+  if (descriptors == nullptr) {
+    return;
+  }
+  if (nonEmpty.empty()) {
+    descriptors->release();
+  } else {
+    cv::vconcat(nonEmpty, *descriptors);
   }
 }
 
-void Feature::subsample(std::vector<cv::KeyPoint> &keyPoints,
-                        cv::Mat &descriptors) const {
-  assert(keyPoints.size() == descriptors.rows);
+void Feature::selectKeyPoints(const cv::Size &imageSize,
+                              std::vector<cv::KeyPoint> &keyPoints) const {
   assert(_sampleSize > 0);
+  if (keyPoints.size() <= static_cast<size_t>(_sampleSize)) {
+    return;
+  }
 
-  std::vector<unsigned int> indices(keyPoints.size());
-  std::iota(indices.begin(), indices.end(), 0);
-  std::random_shuffle(indices.begin(), indices.end());
-  std::vector<cv::KeyPoint> subKeyPoints;
-  cv::Mat subDescriptors;
-  for (int i = 0; i < _sampleSize && i < indices.size(); i++) {
-    subKeyPoints.emplace_back(keyPoints[i]);
-    subDescriptors.push_back(descriptors.row(i));
+  // rank keypoints by response within their grid cell
+  const int n = keyPoints.size();
+  std::vector<int> cells(n);
+  for (int i = 0; i < n; i++) {
+    int col = static_cast<int>(keyPoints[i].pt.x * FEATURE_GRID /
+                               std::max(imageSize.width, 1));
+    int row = static_cast<int>(keyPoints[i].pt.y * FEATURE_GRID /
+                               std::max(imageSize.height, 1));
+    col = std::max(0, std::min(col, FEATURE_GRID - 1));
+    row = std::max(0, std::min(row, FEATURE_GRID - 1));
+    cells[i] = row * FEATURE_GRID + col;
+  }
+  std::vector<int> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    if (cells[a] != cells[b]) {
+      return cells[a] < cells[b];
+    }
+    if (keyPoints[a].response != keyPoints[b].response) {
+      return keyPoints[a].response > keyPoints[b].response;
+    }
+    return a < b;
+  });
+  std::vector<int> ranks(n);
+  for (int i = 0; i < n; i++) {
+    bool sameCell = i > 0 && cells[order[i]] == cells[order[i - 1]];
+    ranks[order[i]] = sameCell ? ranks[order[i - 1]] + 1 : 0;
   }
 
-  keyPoints = subKeyPoints;
-  descriptors = subDescriptors;
+  // take the best keypoint of every cell first, then the second best, and so
+  // on, the stronger first within a round
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    if (ranks[a] != ranks[b]) {
+      return ranks[a] < ranks[b];
+    }
+    if (keyPoints[a].response != keyPoints[b].response) {
+      return keyPoints[a].response > keyPoints[b].response;
+    }
+    return a < b;
+  });
+  order.resize(_sampleSize);
+
+  // keep them in detection order
+  std::sort(order.begin(), order.end());
+  std::vector<cv::KeyPoint> selected;
+  selected.reserve(order.size());
+  for (int i : order) {
+    selected.emplace_back(keyPoints[i]);
+  }
+  keyPoints = std::move(selected);
 }
@@ -2,18 +2,44 @@
 
 #include <opencv2/xfeatures2d.hpp>
 
+#define FEATURE_THREADS 1
+// pixels a tile extends into its neighbors, enough for the support of all but
+// the largest SURF scales
+#define TILE_OVERLAP 64
+// a feature limit is spread over a grid of this many cells in each direction
+#define FEATURE_GRID 8
+
+/**
+ * SURF features. extract() may be called concurrently, each thread uses its
+ * own detector.
+ *
+ * With more than one thread, an image is split into a grid of overlapping
+ * tiles that are extracted in parallel. Each tile keeps the keypoints in its
+ * own part of the grid, so keypoints in overlaps are not duplicated, and the
+ * tiles are merged in grid order, so the result does not depend on timing.
+ *
+ * With a sample size, keypoints are detected first, and only the selected
+ * ones are described: the strongest of each grid cell, then the second
+ * strongest, and so on, so they cover the image evenly.
+ */
 class Feature final {
 public:
-  explicit Feature(int sampleSize = 0); // 0 means no subsampling
+  // sampleSize 0 means no limit
+  explicit Feature(int sampleSize = 0, int numThreads = FEATURE_THREADS);
 
   void extract(const cv::Mat &image, std::vector<cv::KeyPoint> &keyPoints,
                cv::Mat &descriptors) const;
 
 private:
-  void subsample(std::vector<cv::KeyPoint> &keyPoints,
-                 cv::Mat &descriptors) const;
+  // descriptors are not computed if they are nullptr
+  void extractTiles(const cv::Mat &image, std::vector<cv::KeyPoint> &keyPoints,
+                    cv::Mat *descriptors) const;
+
+  // keep at most _sampleSize keypoints, spread over the image
+  void selectKeyPoints(const cv::Size &imageSize,
+                       std::vector<cv::KeyPoint> &keyPoints) const;
 
 private:
   int _sampleSize;
-  cv::Ptr<cv::xfeatures2d::SURF> _detector;
+  int _numThreads;
 };
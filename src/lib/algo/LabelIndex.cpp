@@ -0,0 +1,188 @@
+#include "lib/algo/LabelIndex.h"
+#include "lib/data/CameraModel.h"
+#include "lib/data/Label.h"
+#include "lib/data/Transform.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+const uint32_t LEAF_SIZE = 16;
+
+float getAxis(const cv::Point3f &point, int axis) {
+  return axis == 0 ? point.x : axis == 1 ? point.y : point.z;
+}
+} // namespace
+
+LabelIndex::LabelIndex(const std::vector<Label> &labels) {
+  std::vector<cv::Point3f> points;
+  std::vector<int32_t> nameIds;
+  std::unordered_map<std::string, int32_t> nameMap;
+  for (const auto &label : labels) {
+    auto inserted = nameMap.emplace(label.getName(), _names.size());
+    if (inserted.second) {
+      _names.emplace_back(label.getName());
+    }
+    points.emplace_back(label.getPoint3());
+    nameIds.emplace_back(inserted.first->second);
+  }
+  if (points.empty()) {
+    return;
+  }
+
+  std::vector<int> order(points.size());
+  std::iota(order.begin(), order.end(), 0);
+  build(order, 0, order.size(), points);
+
+  for (int i : order) {
+    _x.emplace_back(points[i].x);
+    _y.emplace_back(points[i].y);
+    _z.emplace_back(points[i].z);
+    _nameIds.emplace_back(nameIds[i]);
+  }
+}
+
+size_t LabelIndex::size() const { return _nameIds.size(); }
+
+const std::string &LabelIndex::getName(int nameId) const {
+  assert(nameId >= 0 && static_cast<size_t>(nameId) < _names.size());
+  return _names[nameId];
+}
+
+void LabelIndex::project(const CameraModel &camera, const Transform &pose,
+                         std::vector<Projection> &projections) const {
+  projections.clear();
+  if (_nodes.empty() || pose.isNull()) {
+    return;
+  }
+
+  // the world in the camera frame
+  Transform t = pose.inverse();
+  const float r00 = t.r11(), r01 = t.r12(), r02 = t.r13();
+  const float r10 = t.r21(), r11 = t.r22(), r12 = t.r23();
+  const float r20 = t.r31(), r21 = t.r32(), r22 = t.r33();
+  const float t0 = t.x(), t1 = t.y(), t2 = t.z();
+  const float fx = camera.fx(), fy = camera.fy();
+  const float cx = camera.cx(), cy = camera.cy();
+  const float width = camera.getImageSize().width;
+  const float height = camera.getImageSize().height;
+
+  // the frustum in the camera frame: in front of the camera, then right of
+  // u = 0, left of u = width, below v = 0 and above v = height. A plane n is
+  // moved to the world frame as (R^T n, n.t).
+  const cv::Vec3f cameraPlanes[] = {{0, 0, 1},
+                                    {fx, 0, cx},
+                                    {-fx, 0, width - cx},
+                                    {0, fy, cy},
+                                    {0, -fy, height - cy}};
+  std::vector<cv::Vec4f> planes;
+  for (const auto &n : cameraPlanes) {
+    planes.emplace_back(r00 * n[0] + r10 * n[1] + r20 * n[2],
+                        r01 * n[0] + r11 * n[1] + r21 * n[2],
+                        r02 * n[0] + r12 * n[1] + r22 * n[2],
+                        n[0] * t0 + n[1] * t1 + n[2] * t2);
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  cull(0, planes, (1u << planes.size()) - 1, ranges);
+
+  // transform, project and clip in one pass over each range
+  const float *x = _x.data();
+  const float *y = _y.data();
+  const float *z = _z.data();
+  for (const auto &range : ranges) {
+    for (uint32_t i = range.first; i < range.second; i++) {
+      float X = r00 * x[i] + r01 * y[i] + r02 * z[i] + t0;
+      float Y = r10 * x[i] + r11 * y[i] + r12 * z[i] + t1;
+      float Z = r20 * x[i] + r21 * y[i] + r22 * z[i] + t2;
+      float invZ = 1.0f / Z;
+      float u = fx * X * invZ + cx;
+      float v = fy * Y * invZ + cy;
+      bool in = (Z > 0) & (u >= 0) & (u <= width) & (v >= 0) & (v <= height);
+      if (in) {
+        projections.push_back(
+            {_nameIds[i], cv::Point3f(x[i], y[i], z[i]), cv::Point2f(u, v)});
+      }
+    }
+  }
+}
+
+int LabelIndex::build(std::vector<int> &order, uint32_t begin, uint32_t end,
+                      const std::vector<cv::Point3f> &points) {
+  int index = _nodes.size();
+  _nodes.emplace_back();
+  Node node;
+  node.min = node.max = points[order[begin]];
+  for (uint32_t i = begin; i < end; i++) {
+    const cv::Point3f &p = points[order[i]];
+    node.min = cv::Point3f(std::min(node.min.x, p.x), std::min(node.min.y, p.y),
+                           std::min(node.min.z, p.z));
+    node.max = cv::Point3f(std::max(node.max.x, p.x), std::max(node.max.y, p.y),
+                           std::max(node.max.z, p.z));
+  }
+  node.begin = begin;
+  node.end = end;
+  node.right = -1;
+
+  if (end - begin > LEAF_SIZE) {
+    // split at the median of the longest side
+    cv::Point3f extent = node.max - node.min;
+    int axis = 0;
+    if (extent.y > extent.x) {
+      axis = 1;
+    }
+    if (extent.z > getAxis(extent, axis)) {
+      axis = 2;
+    }
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle,
+                     order.begin() + end, [&](int a, int b) {
+                       return getAxis(points[a], axis) <
+                              getAxis(points[b], axis);
+                     });
+    build(order, begin, middle, points);
+    node.right = build(order, middle, end, points);
+  }
+
+  _nodes[index] = node;
+  return index;
+}
+
+void LabelIndex::cull(
+    int node, const std::vector<cv::Vec4f> &planes, unsigned mask,
+    std::vector<std::pair<uint32_t, uint32_t>> &ranges) const {
+  const Node &n = _nodes[node];
+  for (size_t i = 0; i < planes.size(); i++) {
+    if ((mask & (1u << i)) == 0) {
+      continue;
+    }
+    // the corners of the box farthest inside and farthest outside the plane
+    const cv::Vec4f &p = planes[i];
+    float inside = p[3], outside = p[3];
+    inside += p[0] * (p[0] > 0 ? n.max.x : n.min.x);
+    inside += p[1] * (p[1] > 0 ? n.max.y : n.min.y);
+    inside += p[2] * (p[2] > 0 ? n.max.z : n.min.z);
+    outside += p[0] * (p[0] > 0 ? n.min.x : n.max.x);
+    outside += p[1] * (p[1] > 0 ? n.min.y : n.max.y);
+    outside += p[2] * (p[2] > 0 ? n.min.z : n.max.z);
+    if (inside < 0) {
+      return;
+    }
+    if (outside >= 0) {
+      mask &= ~(1u << i);
+    }
+  }
+
+  // points are contiguous in a subtree, so a box inside all planes is one
+  // range
+  if (n.right < 0 || mask == 0) {
+    if (!ranges.empty() && ranges.back().second == n.begin) {
+      ranges.back().second = n.end;
+    } else {
+      ranges.emplace_back(n.begin, n.end);
+    }
+    return;
+  }
+  cull(node + 1, planes, mask, ranges);
+  cull(n.right, planes, mask, ranges);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+class CameraModel;
+class Label;
+class Transform;
+
+/**
+ * The labels of a room, laid out for projection into query images. Points
+ * are flat arrays ordered by the leaves of a bounding volume hierarchy, and
+ * names are interned, so that a query culls the boxes outside the view
+ * frustum and projects only the points in the remaining leaves, in one pass
+ * each. The index is immutable, so project() may be called concurrently.
+ */
+class LabelIndex final {
+public:
+  /*
+   * a label that projects into the image
+   */
+  struct Projection {
+    int nameId;
+    cv::Point3f point3;
+    cv::Point2f point2;
+  };
+
+  explicit LabelIndex(const std::vector<Label> &labels);
+
+  size_t size() const;
+  const std::string &getName(int nameId) const;
+
+  /*
+   * project the labels in front of the camera and inside the image, in index
+   * order. pose is the camera in the world frame.
+   */
+  void project(const CameraModel &camera, const Transform &pose,
+               std::vector<Projection> &projections) const;
+
+private:
+  /*
+   * the left child of an inner node follows it, a leaf has right = -1
+   */
+  struct Node {
+    cv::Point3f min;
+    cv::Point3f max;
+    uint32_t begin;
+    uint32_t end;
+    int32_t right;
+  };
+
+  int build(std::vector<int> &order, uint32_t begin, uint32_t end,
+            const std::vector<cv::Point3f> &points);
+
+  /*
+   * append the point ranges of the leaves that may intersect the frustum.
+   * planes are (normal, offset) in the world frame, the inside is where
+   * normal.dot(point) + offset >= 0, and bit i of mask means plane i still
+   * cuts the node.
+   */
+  void cull(int node, const std::vector<cv::Vec4f> &planes, unsigned mask,
+            std::vector<std::pair<uint32_t, uint32_t>> &ranges) const;
+
+private:
+  std::vector<float> _x, _y, _z;
+  std::vector<int32_t> _nameIds;
+  std::vector<std::string> _names;
+  std::vector<Node> _nodes; // root first
+};
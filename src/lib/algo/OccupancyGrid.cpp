@@ -0,0 +1,182 @@
+#include "lib/algo/OccupancyGrid.h"
+#include "lib/data/Image.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <pcl/common/transforms.h>
+
+namespace {
+// bounds the grid of a room to 2 MB of bits. Points are counted per voxel
+// in a sorted list, so building takes memory for the points, not the voxels.
+const size_t MAX_VOXELS = 1 << 24;
+} // namespace
+
+OccupancyGrid::OccupancyGrid()
+    : _voxelSize(0), _sizeX(0), _sizeY(0), _sizeZ(0) {}
+
+OccupancyGrid::OccupancyGrid(const std::map<int, Image> &images,
+                             float voxelSize, int decimation, int minPoints,
+                             int numThreads)
+    : OccupancyGrid() {
+  // depth points of each image in the room frame
+  std::vector<const Image *> imageList;
+  for (const auto &image : images) {
+    if (!image.second.getDepth().empty()) {
+      imageList.emplace_back(&image.second);
+    }
+  }
+  std::vector<std::vector<cv::Point3f>> clouds(imageList.size());
+  int numImages = imageList.size();
+  Utility::parallelFor(0, numImages, numThreads, [&](int i) {
+    auto cloud = imageList[i]->getCloud(decimation);
+    pcl::transformPointCloud(*cloud, *cloud,
+                             imageList[i]->getPose().toEigen4f());
+    clouds[i].reserve(cloud->size());
+    for (const auto &point : *cloud) {
+      clouds[i].emplace_back(point.x, point.y, point.z);
+    }
+  });
+
+  cv::Point3f min(FLT_MAX, FLT_MAX, FLT_MAX);
+  cv::Point3f max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (const auto &cloud : clouds) {
+    for (const auto &p : cloud) {
+      min = cv::Point3f(std::min(min.x, p.x), std::min(min.y, p.y),
+                        std::min(min.z, p.z));
+      max = cv::Point3f(std::max(max.x, p.x), std::max(max.y, p.y),
+                        std::max(max.z, p.z));
+    }
+  }
+  if (min.x > max.x || voxelSize <= 0) {
+    return;
+  }
+
+  cv::Point3f extent = max - min;
+  auto getSize = [&](float length) {
+    return static_cast<int>(std::floor(length / voxelSize)) + 1;
+  };
+  while (static_cast<size_t>(getSize(extent.x)) * getSize(extent.y) *
+             getSize(extent.z) >
+         MAX_VOXELS) {
+    voxelSize *= 2;
+  }
+  _origin = min;
+  _voxelSize = voxelSize;
+  _sizeX = getSize(extent.x);
+  _sizeY = getSize(extent.y);
+  _sizeZ = getSize(extent.z);
+
+  const size_t numVoxels = static_cast<size_t>(_sizeX) * _sizeY * _sizeZ;
+  size_t numPoints = 0;
+  for (const auto &cloud : clouds) {
+    numPoints += cloud.size();
+  }
+  std::vector<uint32_t> voxels; // of each point
+  voxels.reserve(numPoints);
+  for (const auto &cloud : clouds) {
+    for (const auto &p : cloud) {
+      int x = std::min(static_cast<int>((p.x - min.x) / voxelSize), _sizeX - 1);
+      int y = std::min(static_cast<int>((p.y - min.y) / voxelSize), _sizeY - 1);
+      int z = std::min(static_cast<int>((p.z - min.z) / voxelSize), _sizeZ - 1);
+      voxels.emplace_back((static_cast<uint32_t>(z) * _sizeY + y) * _sizeX +
+                          x);
+    }
+  }
+  std::sort(voxels.begin(), voxels.end());
+
+  _bits.assign((numVoxels + 63) / 64, 0);
+  for (size_t begin = 0, end; begin < voxels.size(); begin = end) {
+    uint32_t i = voxels[begin];
+    end = begin + 1;
+    while (end < voxels.size() && voxels[end] == i) {
+      end++;
+    }
+    if (static_cast<int>(end - begin) >= minPoints) {
+      _bits[i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+}
+
+bool OccupancyGrid::empty() const { return _bits.empty(); }
+
+float OccupancyGrid::getVoxelSize() const { return _voxelSize; }
+
+bool OccupancyGrid::isOccluded(const cv::Point3f &from, const cv::Point3f &to,
+                               float margin) const {
+  if (empty()) {
+    return false;
+  }
+  cv::Point3f d = to - from;
+  float length = std::sqrt(d.dot(d));
+  if (length <= margin) {
+    return false;
+  }
+  const float dir[3] = {d.x / length, d.y / length, d.z / length};
+  const float start[3] = {from.x - _origin.x, from.y - _origin.y,
+                          from.z - _origin.z};
+  const int sizes[3] = {_sizeX, _sizeY, _sizeZ};
+
+  // clip the segment to the grid
+  float tBegin = 0;
+  float tEnd = length - margin;
+  for (int a = 0; a < 3; a++) {
+    float bound = sizes[a] * _voxelSize;
+    if (dir[a] == 0) {
+      if (start[a] < 0 || start[a] >= bound) {
+        return false;
+      }
+      continue;
+    }
+    float t0 = (0 - start[a]) / dir[a];
+    float t1 = (bound - start[a]) / dir[a];
+    tBegin = std::max(tBegin, std::min(t0, t1));
+    tEnd = std::min(tEnd, std::max(t0, t1));
+  }
+  if (tBegin >= tEnd) {
+    return false;
+  }
+
+  // walk the voxels along the segment (Amanatides and Woo)
+  int voxel[3], step[3];
+  float tMax[3], tDelta[3];
+  for (int a = 0; a < 3; a++) {
+    float p = start[a] + tBegin * dir[a];
+    int index = static_cast<int>(std::floor(p / _voxelSize));
+    voxel[a] = std::max(0, std::min(index, sizes[a] - 1));
+    if (dir[a] > 0) {
+      step[a] = 1;
+      tDelta[a] = _voxelSize / dir[a];
+      tMax[a] = tBegin + ((voxel[a] + 1) * _voxelSize - p) / dir[a];
+    } else if (dir[a] < 0) {
+      step[a] = -1;
+      tDelta[a] = -_voxelSize / dir[a];
+      tMax[a] = tBegin + (voxel[a] * _voxelSize - p) / dir[a];
+    } else {
+      step[a] = 0;
+      tDelta[a] = FLT_MAX;
+      tMax[a] = FLT_MAX;
+    }
+  }
+
+  float t = tBegin;
+  while (t < tEnd) {
+    if (isOccupied(voxel[0], voxel[1], voxel[2])) {
+      return true;
+    }
+    int a = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2)
+                              : (tMax[1] < tMax[2] ? 1 : 2);
+    t = tMax[a];
+    voxel[a] += step[a];
+    tMax[a] += tDelta[a];
+    if (voxel[a] < 0 || voxel[a] >= sizes[a]) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool OccupancyGrid::isOccupied(int x, int y, int z) const {
+  size_t i = (static_cast<size_t>(z) * _sizeY + y) * _sizeX + x;
+  return (_bits[i / 64] >> (i % 64)) & 1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// meters
+#define OCCUPANCY_VOXEL_SIZE 0.1
+// depth image pixels per cloud point along each side
+#define OCCUPANCY_DECIMATION 8
+// depth points in a voxel for it to count as occupied, so that stray points
+// don't occlude anything
+#define OCCUPANCY_MIN_POINTS 3
+
+class Image;
+
+/**
+ * A coarse voxel occupancy grid of a room, built from the depth images of
+ * its database. It stands in for the room's surfaces to decide whether a
+ * point is hidden from a viewpoint. The grid is immutable, so queries may be
+ * concurrent.
+ */
+class OccupancyGrid final {
+public:
+  explicit OccupancyGrid();
+
+  /*
+   * voxelSize grows if the room would need more voxels than a fixed budget
+   */
+  explicit OccupancyGrid(const std::map<int, Image> &images,
+                         float voxelSize = OCCUPANCY_VOXEL_SIZE,
+                         int decimation = OCCUPANCY_DECIMATION,
+                         int minPoints = OCCUPANCY_MIN_POINTS,
+                         int numThreads = 0);
+
+  bool empty() const;
+  float getVoxelSize() const;
+
+  /*
+   * whether an occupied voxel is on the segment from a viewpoint to a point,
+   * ignoring the last margin meters, where the surface of the point itself is
+   */
+  bool isOccluded(const cv::Point3f &from, const cv::Point3f &to,
+                  float margin) const;
+
+private:
+  bool isOccupied(int x, int y, int z) const;
+
+private:
+  cv::Point3f _origin; // the minimum corner of the grid
+  float _voxelSize;
+  int _sizeX, _sizeY, _sizeZ; // voxels along each axis
+  std::vector<uint64_t> _bits; // x fastest, then y, then z
+};
@@ -2,171 +2,209 @@
 #include "lib/data/CameraModel.h"
 #include "lib/data/Transform.h"
 #include "lib/util/Utility.h"
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
 #include <opencv2/opencv.hpp>
 #include <pcl/common/transforms.h>
 
 Perspective::Perspective(const std::map<int, Room> &rooms,
-                         const std::map<int, Word> &words, int corrLimit,
-                         float distRatio)
-    : _rooms(rooms), _words(words), _corrLimit(corrLimit),
-      _distRatio(distRatio) {}
+                         const WordStore &words, int corrLimit,
+                         float distRatio, const std::string &pnpType,
+                         int indexMinPoints, int numThreads)
+    : _words(words), _corrLimit(corrLimit), _distRatio(distRatio),
+      _pnpType(pnpType) {
+  // entries are ordered by word, so the words of each room are ascending
+  std::map<int, std::pair<std::vector<int>, std::vector<uint64_t>>> roomWords;
+  Span<const uint64_t> wordEntryOffsets = _words.getWordEntryOffsets();
+  Span<const int32_t> entryRoomIds = _words.getEntryRoomIds();
+  for (int w = 0; w < _words.getNumWords(); w++) {
+    for (uint64_t e = wordEntryOffsets[w]; e < wordEntryOffsets[w + 1]; e++) {
+      auto &room = roomWords[entryRoomIds[e]];
+      room.first.emplace_back(w);
+      room.second.emplace_back(e);
+    }
+  }
+  for (const auto &room : rooms) {
+    int roomId = room.first;
+    auto &ids = roomWords[roomId];
+    _layouts.emplace(roomId, RoomLayout(roomId, _words.getNumWords(), ids.first,
+                                        std::move(ids.second)));
+  }
+
+  // large entries are searched through their projections
+  std::vector<uint64_t> entries;
+  Span<const uint64_t> entryPointOffsets = _words.getEntryPointOffsets();
+  for (uint64_t e = 0; e < _words.getNumEntries(); e++) {
+    if (entryPointOffsets[e + 1] - entryPointOffsets[e] >=
+        static_cast<uint64_t>(std::max(indexMinPoints, 2))) {
+      entries.emplace_back(e);
+    }
+  }
+  std::vector<std::unique_ptr<ProjectionIndex>> indices(entries.size());
+  auto buildIndex = [&](int i) {
+    indices[i] = std::make_unique<ProjectionIndex>(
+        _words.getEntryDescriptors(entries[i]));
+  };
+  Utility::parallelFor(0, static_cast<int>(entries.size()), numThreads,
+                       buildIndex);
+  for (unsigned int i = 0; i < entries.size(); i++) {
+    _entryIndices.emplace(entries[i], std::move(*indices[i]));
+  }
+}
 
 Transform Perspective::localize(const std::vector<int> &wordIds,
                                 const std::vector<cv::KeyPoint> &keyPoints,
                                 const cv::Mat &descriptors,
-                                const CameraModel &camera, int roomId) const {
+                                const CameraModel &camera, int roomId,
+                                PoseStats *stats,
+                                const std::atomic<bool> *cancel,
+                                const Transform *guess) const {
   Transform pose;
+  PoseStats localStats;
+  if (stats == nullptr) {
+    stats = &localStats;
+  }
+  *stats = PoseStats();
 
   if (wordIds.size() == 0) {
     return pose;
   }
+  assert(wordIds.size() == keyPoints.size());
+
+  const auto iter = _layouts.find(roomId);
+  if (iter == _layouts.end()) {
+    return pose;
+  }
 
-  std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>> words2 =
-      getWords2(wordIds, keyPoints, descriptors);
-  std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> words3 =
-      getWords3(std::set<int>(wordIds.begin(), wordIds.end()), roomId);
+  std::vector<int> order;
+  std::vector<WordMatch> wordMatches =
+      getWordMatches(wordIds, iter->second, order);
 
   std::vector<cv::Point2f> imagePoints;
   std::vector<cv::Point3f> objectPoints;
-  getMatchPoints(words2, words3, imagePoints, objectPoints);
+  std::vector<float> scores;
+  getMatchPoints(wordMatches, order, keyPoints, descriptors, imagePoints,
+                 objectPoints, scores, cancel);
+  if (cancel != nullptr && *cancel) {
+    return pose;
+  }
   std::cout << "imagePoints.size() = " << imagePoints.size()
             << ", objectPoints.size() = " << objectPoints.size() << std::endl;
 
   // 3D to 2D (PnP)
-  pose = solvePnP(imagePoints, objectPoints, camera);
+  pose = solvePnP(imagePoints, objectPoints, scores, camera, *stats, cancel,
+                  guess);
 
   return pose;
 }
 
-std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>>
-Perspective::getWords2(const std::vector<int> &wordIds,
-                       const std::vector<cv::KeyPoint> &keyPoints,
-                       const cv::Mat &descriptors) {
-  std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>> words2;
-  assert(wordIds.size() == keyPoints.size());
-  unsigned int i = 0;
-  for (const auto wordId : wordIds) {
-    // an empty vector is ceated if wordId is not in words2
-    words2[wordId].first.emplace_back(keyPoints[i]);
-    words2[wordId].second.push_back(descriptors.row(i));
-    i++;
-  }
-
-  return words2;
-}
-
-std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>>
-Perspective::getWords3(const std::set<int> &wordIds, int roomId) const {
-  std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>>
-      words3; // wordId: point3
-
-  const auto &roomWords = _rooms.at(roomId).getWordIds();
-
-  for (int wordId : wordIds) {
-    auto iter = roomWords.find(wordId);
-    if (iter == roomWords.end()) {
-      continue;
+std::vector<Perspective::WordMatch>
+Perspective::getWordMatches(const std::vector<int> &wordIds,
+                            const RoomLayout &layout,
+                            std::vector<int> &order) const {
+  // query point indices ordered by word, so the points of a word are a range
+  order.resize(wordIds.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return wordIds[a] < wordIds[b]; });
+
+  std::vector<WordMatch> wordMatches;
+  std::vector<std::pair<size_t, size_t>> counts; // count: word match
+  for (size_t begin = 0; begin < order.size();) {
+    int wordId = wordIds[order[begin]];
+    size_t end = begin + 1;
+    while (end < order.size() && wordIds[order[end]] == wordId) {
+      end++;
     }
-
-    const auto jter = _words.find(wordId);
-    assert(jter != _words.end());
-    const Word &word = jter->second;
-    const auto &points3 = word.getPoints3Map().at(roomId);
-    cv::Mat desc = word.getDescriptorsByDb().at(roomId);
-
-    unsigned int i = 0;
-    for (const auto &point3 : points3) {
-      // an empty vector is ceated if wordId is not in words3
-      words3[wordId].first.emplace_back(point3);
-      words3[wordId].second.push_back(desc.row(i));
-      i++;
+    long entry = layout.getEntry(wordId);
+    if (entry >= 0) {
+      size_t count = (end - begin) + _words.getEntryPoints3(entry).size();
+      counts.emplace_back(count, wordMatches.size());
+      wordMatches.push_back({wordId, static_cast<int>(begin),
+                             static_cast<int>(end),
+                             static_cast<uint64_t>(entry)});
     }
+    begin = end;
   }
 
-  return words3;
-}
-
-std::map<int, int> Perspective::countWords(
-    const std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>> &words2,
-    const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> &words3)
-    const {
-  std::map<int, int> counts;
-
-  for (const auto word : words2) {
-    counts.emplace(word.first, word.second.first.size());
-  }
-  for (const auto word : words3) {
-    counts.at(word.first) += word.second.first.size();
+  // iterate from word with less points
+  std::sort(counts.begin(), counts.end());
+  std::vector<WordMatch> sorted;
+  sorted.reserve(wordMatches.size());
+  for (const auto &count : counts) {
+    sorted.emplace_back(wordMatches[count.second]);
   }
-
-  return counts;
+  return sorted;
 }
 
-void Perspective::getMatchPoints(
-    const std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>> &words2,
-    const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> &words3,
-    std::vector<cv::Point2f> &imagePoints,
-    std::vector<cv::Point3f> &objectPoints) const {
-  std::map<int, int> wordCounts =
-      countWords(words2, words3); // word id -> count of both words2 and words3
-  std::vector<std::pair<int, int>> inverseCounts;
-  for (const auto &count : wordCounts) {
-    inverseCounts.emplace_back(count.second, count.first);
-  }
-  std::sort(inverseCounts.begin(), inverseCounts.end());
-
+void Perspective::getMatchPoints(const std::vector<WordMatch> &wordMatches,
+                                 const std::vector<int> &order,
+                                 const std::vector<cv::KeyPoint> &keyPoints,
+                                 const cv::Mat &descriptors,
+                                 std::vector<cv::Point2f> &imagePoints,
+                                 std::vector<cv::Point3f> &objectPoints,
+                                 std::vector<float> &scores,
+                                 const std::atomic<bool> *cancel) const {
   int matchCount = 0;
-  // iterate from word with less points
-  for (const auto &count : inverseCounts) {
-    int wordId = count.second;
-    unsigned int i = 0;
-
-    assert(words2.find(wordId) != words2.end());
-    if (words3.find(wordId) == words3.end()) {
-      continue;
+  for (const auto &wordMatch : wordMatches) {
+    if (cancel != nullptr && *cancel) {
+      return;
     }
-
-    for (const auto &point2 : words2.at(wordId).first) {
+    for (int i = wordMatch.begin; i < wordMatch.end; i++) {
+      int index = order[i];
       cv::Point3f point3;
-      cv::Mat desc = words2.at(wordId).second.row(i);
-      if (findMatchPoint3(desc, wordId, words3, point3)) {
-        imagePoints.emplace_back(point2.pt);
+      float score;
+      if (findMatchPoint3(descriptors.row(index), wordMatch.entry, point3,
+                          score)) {
+        imagePoints.emplace_back(keyPoints[index].pt);
         objectPoints.emplace_back(point3);
+        scores.emplace_back(score);
         matchCount++;
         if (_corrLimit > 0 && matchCount >= _corrLimit) {
           return;
         }
       }
-      i++;
     }
   }
 }
 
-bool Perspective::findMatchPoint3(
-    const cv::Mat &descriptor, int wordId,
-    const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> &words3,
-    cv::Point3f &point3) const {
+bool Perspective::findMatchPoint3(const cv::Mat &descriptor, uint64_t entry,
+                                  cv::Point3f &point3, float &score) const {
   assert(descriptor.rows == 1);
 
-  if (words3.find(wordId) == words3.end()) {
-    return false;
-  }
-
-  if (words3.at(wordId).first.size() == 1) {
-    point3 = words3.at(wordId).first.at(0);
+  Span<const cv::Point3f> points3 = _words.getEntryPoints3(entry);
+  if (points3.size() == 1) {
+    // unique in the room, but with nothing to compare with
+    point3 = points3[0];
+    score = _distRatio;
     return true;
   }
 
-  std::vector<std::pair<float, int>> dists;
-  for (int i = 0; i < words3.at(wordId).second.rows; i++) {
-    float dist =
-        cv::norm(descriptor, words3.at(wordId).second.row(i), cv::NORM_L2);
-    dists.emplace_back(dist, i);
+  // the two nearest points, ordered by (distance, index)
+  std::pair<float, int> first(FLT_MAX, -1);
+  std::pair<float, int> second(FLT_MAX, -1);
+  const auto iter = _entryIndices.find(entry);
+  if (iter != _entryIndices.end()) {
+    iter->second.searchTwo(descriptor, first, second);
+  } else {
+    cv::Mat entryDescriptors = _words.getEntryDescriptors(entry);
+    for (int i = 0; i < entryDescriptors.rows; i++) {
+      std::pair<float, int> dist(
+          cv::norm(descriptor, entryDescriptors.row(i), cv::NORM_L2), i);
+      if (dist < first) {
+        second = first;
+        first = dist;
+      } else if (dist < second) {
+        second = dist;
+      }
+    }
   }
-  std::partial_sort(dists.begin(), dists.begin() + 2, dists.end());
-  if (dists.at(0).first / dists.at(1).first <= _distRatio) {
-    point3 = words3.at(wordId).first.at(dists.at(0).second);
+  score = first.first / second.first;
+  if (score <= _distRatio) {
+    point3 = points3[first.second];
     return true;
   }
 
@@ -175,31 +213,93 @@ bool Perspective::findMatchPoint3(
 
 Transform Perspective::solvePnP(const std::vector<cv::Point2f> &imagePoints,
                                 const std::vector<cv::Point3f> &objectPoints,
-                                const CameraModel &camera) {
+                                const std::vector<float> &scores,
+                                const CameraModel &camera,
+                                PoseStats &stats,
+                                const std::atomic<bool> *cancel,
+                                const Transform *guess) const {
   Transform transform;
 
   assert(imagePoints.size() == objectPoints.size());
+  assert(imagePoints.size() == scores.size());
+  stats.correspondences = imagePoints.size();
   if (imagePoints.size() == 0 || objectPoints.size() == 0) {
     return transform;
   }
 
-  // PnPRansac
-  cv::Mat K = camera.K();
-  cv::Mat D = camera.D();
   cv::Mat rvec(1, 3, CV_64FC1);
   cv::Mat tvec;
-
-  bool useExtrinsicGuess = false;
-  int iterationsCount = 100;
-  float reprojectionError = 8.0;
-  double confidence = 0.99;
+  bool useGuess = guess != nullptr && !guess->isNull();
+  if (useGuess) {
+    // the guess is in the world frame, PnP works in the image frame
+    Transform t = guess->inverse();
+    cv::Mat R = (cv::Mat_<double>(3, 3) << t.r11(), t.r12(), t.r13(), //
+                 t.r21(), t.r22(), t.r23(),                          //
+                 t.r31(), t.r32(), t.r33());
+    cv::Rodrigues(R, rvec);
+    tvec = (cv::Mat_<double>(3, 1) << t.x(), t.y(), t.z());
+  }
   std::vector<int> inliers;
-
-  bool success =
-      cv::solvePnPRansac(objectPoints, imagePoints, K, D, rvec, tvec,
-                         useExtrinsicGuess, iterationsCount, reprojectionError,
-                         confidence, inliers, cv::SOLVEPNP_EPNP);
-  // TODO check RTABMap refine model code
+  bool success;
+  if (_pnpType == "prosac") {
+    // best correspondences first, ties in match order
+    std::vector<int> order(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return scores[a] < scores[b]; });
+    std::vector<cv::Point2f> orderedImagePoints;
+    std::vector<cv::Point3f> orderedObjectPoints;
+    for (int i : order) {
+      orderedImagePoints.emplace_back(imagePoints[i]);
+      orderedObjectPoints.emplace_back(objectPoints[i]);
+    }
+    success = _prosac.solve(orderedImagePoints, orderedObjectPoints, camera,
+                            rvec, tvec, inliers, stats.iterations, useGuess,
+                            cancel);
+    for (int &inlier : inliers) {
+      inlier = order[inlier];
+    }
+  } else {
+    // PnPRansac
+    cv::Mat K = camera.K();
+    cv::Mat D = camera.D();
+
+    bool useExtrinsicGuess = useGuess;
+    int iterationsCount = 100;
+    float reprojectionError = PNP_REPROJECTION_ERROR;
+    double confidence = PNP_CONFIDENCE;
+
+    // EPnP ignores the initial pose, so a guess is only used by the
+    // iterative solver, which starts from it in the sample fits and the
+    // final fit on the inliers
+    int flags = useExtrinsicGuess ? cv::SOLVEPNP_ITERATIVE : cv::SOLVEPNP_EPNP;
+    success = cv::solvePnPRansac(objectPoints, imagePoints, K, D, rvec, tvec,
+                                 useExtrinsicGuess, iterationsCount,
+                                 reprojectionError, confidence, inliers,
+                                 flags);
+    // TODO check RTABMap refine model code
+  }
+  if (cancel != nullptr && *cancel) {
+    return transform;
+  }
+  stats.inliers = inliers.size();
+  std::cout << "PnP " << _pnpType << ": " << stats.inliers << " inliers of "
+            << stats.correspondences << " correspondences";
+  if (stats.iterations > 0) {
+    std::cout << ", " << stats.iterations << " iterations";
+  }
+  std::cout << std::endl;
+
+  if (success && inliers.size() >= 4) {
+    std::vector<cv::Point2f> inlierImagePoints;
+    std::vector<cv::Point3f> inlierObjectPoints;
+    for (int inlier : inliers) {
+      inlierImagePoints.emplace_back(imagePoints[inlier]);
+      inlierObjectPoints.emplace_back(objectPoints[inlier]);
+    }
+    refine(inlierImagePoints, inlierObjectPoints, camera, rvec, tvec, stats);
+    std::cout << "PnP refined: rms " << stats.rms << " px" << std::endl;
+  }
 
   if (success) {
     cv::Mat R;
@@ -215,9 +315,46 @@ Transform Perspective::solvePnP(const std::vector<cv::Point2f> &imagePoints,
     // change the base coordiate of the transform from the image coordinate to
     // the world coordiante
     transform = transform.inverse();
-
-    // TODO: compute variance, which is the rms of reprojection errors
   }
 
   return transform;
 }
+
+void Perspective::refine(const std::vector<cv::Point2f> &imagePoints,
+                         const std::vector<cv::Point3f> &objectPoints,
+                         const CameraModel &camera, cv::Mat &rvec,
+                         cv::Mat &tvec, PoseStats &stats) {
+  assert(imagePoints.size() == objectPoints.size());
+  const int n = imagePoints.size();
+  cv::Mat K = camera.K();
+  cv::Mat D = camera.D();
+
+  // SOLVEPNP_ITERATIVE from a guess is Levenberg-Marquardt
+  rvec.convertTo(rvec, CV_64F);
+  tvec.convertTo(tvec, CV_64F);
+  rvec = rvec.reshape(1, 3);
+  tvec = tvec.reshape(1, 3);
+  cv::solvePnP(objectPoints, imagePoints, K, D, rvec, tvec, true,
+               cv::SOLVEPNP_ITERATIVE);
+
+  std::vector<cv::Point2f> projected;
+  cv::Mat jacobian;
+  cv::projectPoints(objectPoints, rvec, tvec, K, D, projected, jacobian);
+  double sumSquares = 0;
+  for (int i = 0; i < n; i++) {
+    cv::Point2f d = projected[i] - imagePoints[i];
+    sumSquares += d.x * d.x + d.y * d.y;
+  }
+  stats.rms = std::sqrt(sumSquares / n);
+
+  // Gauss-Newton covariance of the 6 pose parameters, sigma^2 (J^T J)^-1,
+  // with sigma^2 estimated from the residuals of 2n coordinates
+  if (2 * n > 6) {
+    cv::Mat J = jacobian.colRange(0, 6);
+    cv::Mat information = J.t() * J;
+    cv::Mat inverse;
+    if (cv::invert(information, inverse, cv::DECOMP_CHOLESKY) != 0) {
+      stats.covariance = inverse * (sumSquares / (2 * n - 6));
+    }
+  }
+}
@@ -1,66 +1,109 @@
 #pragma once
 
+#include "lib/algo/ProjectionIndex.h"
+#include "lib/algo/Prosac.h"
+#include "lib/data/PoseStats.h"
 #include "lib/data/Room.h"
-#include "lib/data/Word.h"
+#include "lib/data/RoomLayout.h"
+#include "lib/data/WordStore.h"
+#include <atomic>
 #include <memory>
 #include <opencv2/core/core.hpp>
-#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define CORR_LIMIT 0
 #define DIST_RATIO 0.7
+// words with at least this many points in a room get a projection index
+#define INDEX_MIN_POINTS 64
+// "ransac" for cv::solvePnPRansac, or "prosac"
+#define PNP_TYPE "ransac"
 
 class CameraModel;
 class Transform;
 
+/**
+ * Estimates the pose of a query image in a room. Room layouts and projection
+ * indexes are built once, so localize() is reentrant. A localization can be
+ * cancelled from another thread, e.g. once another room has been verified.
+ * A guessed pose, e.g. predicted from the previous frames of a stream, seeds
+ * PnP.
+ */
 class Perspective final {
 public:
   explicit Perspective(const std::map<int, Room> &rooms,
-                       const std::map<int, Word> &words,
-                       int corrLimit = CORR_LIMIT,
-                       float distRatio = DIST_RATIO);
+                       const WordStore &words, int corrLimit = CORR_LIMIT,
+                       float distRatio = DIST_RATIO,
+                       const std::string &pnpType = PNP_TYPE,
+                       int indexMinPoints = INDEX_MIN_POINTS,
+                       int numThreads = 0);
 
   Transform localize(const std::vector<int> &wordIds,
                      const std::vector<cv::KeyPoint> &keyPoints,
                      const cv::Mat &descriptors, const CameraModel &camera,
-                     int roomId) const;
+                     int roomId, PoseStats *stats = nullptr,
+                     const std::atomic<bool> *cancel = nullptr,
+                     const Transform *guess = nullptr) const;
 
 private:
-  static std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>>
-  getWords2(const std::vector<int> &wordIds,
-            const std::vector<cv::KeyPoint> &keyPoints,
-            const cv::Mat &descriptors);
+  /*
+   * the query points of a word are [begin, end) of the query order, and its
+   * points in the room are in word store entry
+   */
+  struct WordMatch {
+    int wordId;
+    int begin;
+    int end;
+    uint64_t entry;
+  };
 
   /**
-   * get 3D point and descriptors, indexed by word Id, from the database
+   * group query points by word, keeping the words that are in the room, with
+   * words with fewer points first
    */
-  std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>>
-  getWords3(const std::set<int> &wordIds, int roomId) const;
+  std::vector<WordMatch> getWordMatches(const std::vector<int> &wordIds,
+                                        const RoomLayout &layout,
+                                        std::vector<int> &order) const;
 
-  std::map<int, int>
-  countWords(const std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>>
-                 &words2,
-             const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>>
-                 &words3) const;
+  /**
+   * scores are distance ratios of the nearest to the second nearest point,
+   * lower is better
+   */
+  void getMatchPoints(const std::vector<WordMatch> &wordMatches,
+                      const std::vector<int> &order,
+                      const std::vector<cv::KeyPoint> &keyPoints,
+                      const cv::Mat &descriptors,
+                      std::vector<cv::Point2f> &imagePoints,
+                      std::vector<cv::Point3f> &objectPoints,
+                      std::vector<float> &scores,
+                      const std::atomic<bool> *cancel) const;
 
-  void getMatchPoints(
-      const std::map<int, std::pair<std::vector<cv::KeyPoint>, cv::Mat>>
-          &words2,
-      const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> &words3,
-      std::vector<cv::Point2f> &imagePoints,
-      std::vector<cv::Point3f> &objectPoints) const;
+  bool findMatchPoint3(const cv::Mat &descriptor, uint64_t entry,
+                       cv::Point3f &point3, float &score) const;
 
-  bool findMatchPoint3(
-      const cv::Mat &descriptor, int wordId,
-      const std::map<int, std::pair<std::vector<cv::Point3f>, cv::Mat>> &words3,
-      cv::Point3f &point3) const;
+  Transform solvePnP(const std::vector<cv::Point2f> &imagePoints,
+                     const std::vector<cv::Point3f> &objectPoints,
+                     const std::vector<float> &scores,
+                     const CameraModel &camera, PoseStats &stats,
+                     const std::atomic<bool> *cancel,
+                     const Transform *guess) const;
 
-  static Transform solvePnP(const std::vector<cv::Point2f> &imagePoints,
-                            const std::vector<cv::Point3f> &objectPoints,
-                            const CameraModel &camera);
+  /**
+   * refine a pose on its inliers with Levenberg-Marquardt, and estimate its
+   * reprojection error and covariance
+   */
+  static void refine(const std::vector<cv::Point2f> &imagePoints,
+                     const std::vector<cv::Point3f> &objectPoints,
+                     const CameraModel &camera, cv::Mat &rvec, cv::Mat &tvec,
+                     PoseStats &stats);
 
 private:
-  const std::map<int, Room> &_rooms;
-  const std::map<int, Word> &_words;
+  const WordStore &_words;
+  std::map<int, RoomLayout> _layouts; // room ID: room layout
+  std::unordered_map<uint64_t, ProjectionIndex> _entryIndices; // entry: index
   int _corrLimit;
   float _distRatio;
+  std::string _pnpType;
+  Prosac _prosac;
 };
@@ -0,0 +1,73 @@
+#include "lib/algo/ProjectionIndex.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <numeric>
+
+namespace {
+// projections are rounded to float, so bounds keep a margin to stay exact
+const float PROJECTION_MARGIN = 1e-4f;
+
+void insert(const std::pair<float, int> &dist, std::pair<float, int> &first,
+            std::pair<float, int> &second) {
+  if (dist < first) {
+    second = first;
+    first = dist;
+  } else if (dist < second) {
+    second = dist;
+  }
+}
+} // namespace
+
+ProjectionIndex::ProjectionIndex(const cv::Mat &descriptors)
+    : _descriptors(descriptors) {
+  assert(descriptors.type() == CV_32F);
+  assert(descriptors.rows >= 2);
+
+  cv::PCA pca(descriptors, cv::noArray(), cv::PCA::DATA_AS_ROW, 1);
+  _axis = pca.eigenvectors.row(0).clone();
+  cv::normalize(_axis, _axis);
+
+  std::vector<float> projections(descriptors.rows);
+  for (int i = 0; i < descriptors.rows; i++) {
+    projections[i] = _axis.dot(descriptors.row(i));
+  }
+  _rows.resize(descriptors.rows);
+  std::iota(_rows.begin(), _rows.end(), 0);
+  std::sort(_rows.begin(), _rows.end(), [&](int a, int b) {
+    return projections[a] < projections[b];
+  });
+  _projections.reserve(descriptors.rows);
+  for (int row : _rows) {
+    _projections.emplace_back(projections[row]);
+  }
+}
+
+void ProjectionIndex::searchTwo(const cv::Mat &descriptor,
+                                std::pair<float, int> &first,
+                                std::pair<float, int> &second) const {
+  assert(descriptor.rows == 1 && descriptor.cols == _descriptors.cols);
+
+  first = std::make_pair(FLT_MAX, -1);
+  second = std::make_pair(FLT_MAX, -1);
+
+  // walk outwards from the query projection, nearer projection first
+  float projection = _axis.dot(descriptor);
+  int right = std::lower_bound(_projections.begin(), _projections.end(),
+                               projection) -
+              _projections.begin();
+  int left = right - 1;
+  const int size = _projections.size();
+  while (left >= 0 || right < size) {
+    float leftGap = left >= 0 ? projection - _projections[left] : FLT_MAX;
+    float rightGap = right < size ? _projections[right] - projection : FLT_MAX;
+    bool goLeft = leftGap < rightGap;
+    float gap = goLeft ? leftGap : rightGap;
+    if (second.second >= 0 && gap > second.first + PROJECTION_MARGIN) {
+      break;
+    }
+    int row = goLeft ? _rows[left--] : _rows[right++];
+    float dist = cv::norm(descriptor, _descriptors.row(row), cv::NORM_L2);
+    insert(std::make_pair(dist, row), first, second);
+  }
+}
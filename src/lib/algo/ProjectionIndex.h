@@ -0,0 +1,33 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <utility>
+#include <vector>
+
+/**
+ * Exact nearest neighbor search in a set of descriptors, pruned by their
+ * projections on the principal axis. Since the axis is a unit vector, a
+ * descriptor whose projection is farther from the query's than a distance
+ * cannot be closer than that distance, so the search stops once both sides
+ * of the sorted projections are farther than the second nearest distance.
+ */
+class ProjectionIndex final {
+public:
+  /*
+   * descriptors are CV_32F rows, and are referred to, not copied
+   */
+  explicit ProjectionIndex(const cv::Mat &descriptors);
+
+  /*
+   * find the two nearest rows, as (distance, row), ordered by distance then
+   * row. Distances are cv::norm(NORM_L2), as a linear search computes them.
+   */
+  void searchTwo(const cv::Mat &descriptor, std::pair<float, int> &first,
+                 std::pair<float, int> &second) const;
+
+private:
+  cv::Mat _descriptors;
+  cv::Mat _axis;
+  std::vector<float> _projections; // ascending
+  std::vector<int> _rows;          // row of each projection
+};
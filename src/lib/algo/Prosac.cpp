@@ -0,0 +1,237 @@
+#include "lib/algo/Prosac.h"
+#include "lib/data/CameraModel.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <random>
+
+namespace {
+// P3P needs a fourth point to pick one of its solutions
+const int SAMPLE_SIZE = 4;
+// samples in the PROSAC growth schedule, as in the paper
+const double GROWTH_SAMPLES = 200000;
+const int LOCAL_ITERATIONS = 4;
+
+// the iterations after which a better model is unlikely
+int getMaxIterations(double inlierRatio, double confidence, int limit) {
+  double pGood = std::pow(inlierRatio, SAMPLE_SIZE);
+  if (pGood <= 0) {
+    return limit;
+  }
+  if (pGood >= 1) {
+    return 1;
+  }
+  double k = std::log(1 - confidence) / std::log(1 - pGood);
+  return static_cast<int>(std::min<double>(std::ceil(k), limit));
+}
+} // namespace
+
+Prosac::Prosac(float reprojectionError, double confidence, int maxIterations)
+    : _reprojectionError(reprojectionError), _confidence(confidence),
+      _maxIterations(maxIterations) {}
+
+bool Prosac::solve(const std::vector<cv::Point2f> &imagePoints,
+                   const std::vector<cv::Point3f> &objectPoints,
+                   const CameraModel &camera, cv::Mat &rvec, cv::Mat &tvec,
+                   std::vector<int> &inliers, int &iterations, bool useGuess,
+                   const std::atomic<bool> *cancel) const {
+  assert(imagePoints.size() == objectPoints.size());
+  const int n = imagePoints.size();
+  iterations = 0;
+  inliers.clear();
+  if (n < SAMPLE_SIZE) {
+    return false;
+  }
+
+  Points points;
+  for (int i = 0; i < n; i++) {
+    points.x.emplace_back(objectPoints[i].x);
+    points.y.emplace_back(objectPoints[i].y);
+    points.z.emplace_back(objectPoints[i].z);
+    points.u.emplace_back(imagePoints[i].x);
+    points.v.emplace_back(imagePoints[i].y);
+  }
+
+  cv::Mat K = camera.K();
+  std::vector<cv::Point3f> sampleObjectPoints(SAMPLE_SIZE);
+  std::vector<cv::Point2f> sampleImagePoints(SAMPLE_SIZE);
+  std::vector<int> sample(SAMPLE_SIZE);
+
+  // seeded by the input, so that a query gives the same pose every time
+  std::mt19937 rng(n);
+
+  // PROSAC schedule: after tnPrime iterations the prefix grows to subsetSize
+  int subsetSize = SAMPLE_SIZE;
+  double tn = GROWTH_SAMPLES;
+  for (int i = 0; i < SAMPLE_SIZE; i++) {
+    tn *= static_cast<double>(subsetSize - i) / (n - i);
+  }
+  double tnPrime = 1;
+
+  int bestCount = 0;
+  cv::Mat bestRvec, bestTvec;
+  int maxIterations = _maxIterations;
+
+  // a good guess is the first best hypothesis, and may end the run early
+  if (useGuess && !rvec.empty() && !tvec.empty()) {
+    cv::Mat guessRvec, guessTvec;
+    rvec.convertTo(guessRvec, CV_64F);
+    tvec.convertTo(guessTvec, CV_64F);
+    int count = score(points, camera, guessRvec, guessTvec, nullptr);
+    if (count >= SAMPLE_SIZE) {
+      optimize(points, objectPoints, imagePoints, K, camera, guessRvec,
+               guessTvec, count);
+      bestCount = count;
+      bestRvec = guessRvec;
+      bestTvec = guessTvec;
+      maxIterations = getMaxIterations(static_cast<double>(bestCount) / n,
+                                       _confidence, _maxIterations);
+    }
+  }
+  while (iterations < maxIterations) {
+    if (cancel != nullptr && *cancel) {
+      return false;
+    }
+    iterations++;
+    while (subsetSize < n && iterations > tnPrime) {
+      double tnNext = tn * (subsetSize + 1) / (subsetSize + 1 - SAMPLE_SIZE);
+      tnPrime += std::ceil(tnNext - tn);
+      tn = tnNext;
+      subsetSize++;
+    }
+
+    // the newest point of the prefix and others before it, or any points of
+    // the prefix once the schedule has run out
+    int numDrawn = SAMPLE_SIZE;
+    int poolSize = subsetSize;
+    if (iterations <= tnPrime) {
+      sample[SAMPLE_SIZE - 1] = subsetSize - 1;
+      numDrawn = SAMPLE_SIZE - 1;
+      poolSize = subsetSize - 1;
+    }
+    std::uniform_int_distribution<int> pick(0, poolSize - 1);
+    for (int i = 0; i < numDrawn; i++) {
+      int index;
+      do {
+        index = pick(rng);
+      } while (std::find(sample.begin(), sample.begin() + i, index) !=
+               sample.begin() + i);
+      sample[i] = index;
+    }
+    for (int i = 0; i < SAMPLE_SIZE; i++) {
+      sampleObjectPoints[i] = objectPoints[sample[i]];
+      sampleImagePoints[i] = imagePoints[sample[i]];
+    }
+
+    cv::Mat sampleRvec, sampleTvec;
+    if (!cv::solvePnP(sampleObjectPoints, sampleImagePoints, K, cv::Mat(),
+                      sampleRvec, sampleTvec, false, cv::SOLVEPNP_P3P)) {
+      continue;
+    }
+    int count = score(points, camera, sampleRvec, sampleTvec, nullptr);
+    if (count <= bestCount) {
+      continue;
+    }
+
+    optimize(points, objectPoints, imagePoints, K, camera, sampleRvec,
+             sampleTvec, count);
+
+    bestCount = count;
+    bestRvec = sampleRvec;
+    bestTvec = sampleTvec;
+    maxIterations = getMaxIterations(static_cast<double>(bestCount) / n,
+                                     _confidence, _maxIterations);
+  }
+
+  if (bestCount < SAMPLE_SIZE) {
+    return false;
+  }
+  score(points, camera, bestRvec, bestTvec, &inliers);
+  rvec = bestRvec;
+  tvec = bestTvec;
+  return true;
+}
+
+void Prosac::optimize(const Points &points,
+                      const std::vector<cv::Point3f> &objectPoints,
+                      const std::vector<cv::Point2f> &imagePoints,
+                      const cv::Mat &K, const CameraModel &camera,
+                      cv::Mat &rvec, cv::Mat &tvec, int &count) const {
+  std::vector<int> inliers;
+  // refit on the inliers while that gains inliers
+  for (int i = 0; i < LOCAL_ITERATIONS && count >= SAMPLE_SIZE; i++) {
+    score(points, camera, rvec, tvec, &inliers);
+    std::vector<cv::Point3f> inlierObjectPoints;
+    std::vector<cv::Point2f> inlierImagePoints;
+    for (int index : inliers) {
+      inlierObjectPoints.emplace_back(objectPoints[index]);
+      inlierImagePoints.emplace_back(imagePoints[index]);
+    }
+    cv::Mat refinedRvec = rvec.clone();
+    cv::Mat refinedTvec = tvec.clone();
+    cv::solvePnP(inlierObjectPoints, inlierImagePoints, K, cv::Mat(),
+                 refinedRvec, refinedTvec, true, cv::SOLVEPNP_ITERATIVE);
+    int refinedCount = score(points, camera, refinedRvec, refinedTvec, nullptr);
+    if (refinedCount < count) {
+      break;
+    }
+    bool gained = refinedCount > count;
+    rvec = refinedRvec;
+    tvec = refinedTvec;
+    count = refinedCount;
+    if (!gained) {
+      break;
+    }
+  }
+}
+
+int Prosac::score(const Points &points, const CameraModel &camera,
+                  const cv::Mat &rvec, const cv::Mat &tvec,
+                  std::vector<int> *inliers) const {
+  cv::Mat R;
+  cv::Rodrigues(rvec, R);
+  const float r00 = R.at<double>(0, 0), r01 = R.at<double>(0, 1),
+              r02 = R.at<double>(0, 2), r10 = R.at<double>(1, 0),
+              r11 = R.at<double>(1, 1), r12 = R.at<double>(1, 2),
+              r20 = R.at<double>(2, 0), r21 = R.at<double>(2, 1),
+              r22 = R.at<double>(2, 2);
+  const float t0 = tvec.at<double>(0), t1 = tvec.at<double>(1),
+              t2 = tvec.at<double>(2);
+  const float fx = camera.fx(), fy = camera.fy();
+  const float cx = camera.cx(), cy = camera.cy();
+  const float maxError2 = _reprojectionError * _reprojectionError;
+
+  const int n = points.x.size();
+  const float *x = points.x.data();
+  const float *y = points.y.data();
+  const float *z = points.z.data();
+  const float *u = points.u.data();
+  const float *v = points.v.data();
+
+  // no branches in the loop, so that it vectorizes
+  thread_local std::vector<unsigned char> isInlier;
+  isInlier.resize(n);
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    float X = r00 * x[i] + r01 * y[i] + r02 * z[i] + t0;
+    float Y = r10 * x[i] + r11 * y[i] + r12 * z[i] + t1;
+    float Z = r20 * x[i] + r21 * y[i] + r22 * z[i] + t2;
+    float invZ = 1.0f / Z;
+    float du = fx * X * invZ + cx - u[i];
+    float dv = fy * Y * invZ + cy - v[i];
+    unsigned char in = (Z > 0) & (du * du + dv * dv <= maxError2);
+    isInlier[i] = in;
+    count += in;
+  }
+
+  if (inliers != nullptr) {
+    inliers->clear();
+    for (int i = 0; i < n; i++) {
+      if (isInlier[i]) {
+        inliers->emplace_back(i);
+      }
+    }
+  }
+  return count;
+}
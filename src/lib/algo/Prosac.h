@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+#define PNP_REPROJECTION_ERROR 8.0
+#define PNP_CONFIDENCE 0.99
+#define PROSAC_MAX_ITERATIONS 1000
+
+class CameraModel;
+
+/**
+ * RANSAC for PnP with PROSAC sampling (Chum and Matas). Correspondences are
+ * given best first, and samples are drawn from a prefix that grows on the
+ * PROSAC schedule, so good hypotheses come early. Each hypothesis is solved
+ * from a minimal sample with P3P and scored by reprojecting all points in one
+ * pass over flat arrays. A new best hypothesis is refined on its inliers
+ * (local optimization), and the run stops once the best inlier ratio makes a
+ * better one unlikely at the given confidence.
+ */
+class Prosac final {
+public:
+  explicit Prosac(float reprojectionError = PNP_REPROJECTION_ERROR,
+                  double confidence = PNP_CONFIDENCE,
+                  int maxIterations = PROSAC_MAX_ITERATIONS);
+
+  /**
+   * rvec and tvec transform object points into the camera frame. Return
+   * false if no hypothesis has enough inliers, or if cancel is set before
+   * the run ends. With useGuess, rvec and tvec are scored first as the
+   * initial best hypothesis. Distortion is ignored.
+   */
+  bool solve(const std::vector<cv::Point2f> &imagePoints,
+             const std::vector<cv::Point3f> &objectPoints,
+             const CameraModel &camera, cv::Mat &rvec, cv::Mat &tvec,
+             std::vector<int> &inliers, int &iterations,
+             bool useGuess = false,
+             const std::atomic<bool> *cancel = nullptr) const;
+
+private:
+  /**
+   * correspondences as flat arrays, so that scoring vectorizes
+   */
+  struct Points {
+    std::vector<float> x, y, z; // object
+    std::vector<float> u, v;    // image
+  };
+
+  /**
+   * local optimization: refit a hypothesis with count inliers on them while
+   * that gains inliers
+   */
+  void optimize(const Points &points,
+                const std::vector<cv::Point3f> &objectPoints,
+                const std::vector<cv::Point2f> &imagePoints, const cv::Mat &K,
+                const CameraModel &camera, cv::Mat &rvec, cv::Mat &tvec,
+                int &count) const;
+
+  /**
+   * count the points that reproject within the error and are in front of the
+   * camera, and write their indices if inliers is not nullptr
+   */
+  int score(const Points &points, const CameraModel &camera,
+            const cv::Mat &rvec, const cv::Mat &tvec,
+            std::vector<int> *inliers) const;
+
+private:
+  float _reprojectionError;
+  double _confidence;
+  int _maxIterations;
+};
@@ -1,47 +1,127 @@
 #include "lib/algo/RoomSearch.h"
+#include <algorithm>
 #include <cassert>
-#include <iostream>
+#include <cmath>
+
+namespace {
+// scores of rooms, all zero between searches, so that a search only pays
+// for the rooms it touches
+struct Scores {
+  std::vector<float> scores;
+  std::vector<char> isTouched;
+};
+
+Scores &getScores(size_t numRooms) {
+  thread_local Scores scores;
+  if (scores.scores.size() < numRooms) {
+    scores.scores.resize(numRooms, 0);
+    scores.isTouched.resize(numRooms, false);
+  }
+  return scores;
+}
+} // namespace
 
 RoomSearch::RoomSearch(const std::map<int, Room> &rooms,
-                       const std::map<int, Word> &words)
-    : _rooms(rooms), _words(words) {}
+                       const WordStore &words)
+    : _words(words) {
+  std::map<int, int> roomIndices; // room ID: room index
+  for (const auto &room : rooms) {
+    roomIndices.emplace(room.first, _roomIds.size());
+    _roomIds.emplace_back(room.first);
+  }
 
-int RoomSearch::search(const std::vector<int> &wordIds) const {
-  std::map<int, int> counts; // roomId: number of shared words in room
-  for (auto wordId : wordIds) {
-    const auto iter = _words.find(wordId);
-    assert(iter != _words.end());
-    const Word &word = iter->second;
-
-    const auto &points3Map = word.getPoints3Map();
-    for (const auto &points3 : points3Map) {
-      int roomId = points3.first;
-      auto jter = counts.find(roomId);
-      if (jter == counts.end()) {
-        auto ret = counts.emplace(roomId, 0);
-        jter = ret.first;
-      }
-      jter->second++; // TODO: +1 or +points3.size() ?
+  Span<const uint64_t> wordEntryOffsets = _words.getWordEntryOffsets();
+  Span<const int32_t> entryRoomIds = _words.getEntryRoomIds();
+  Span<const uint64_t> entryPointOffsets = _words.getEntryPointOffsets();
+  const size_t numEntries = _words.getNumEntries();
+  const int numWords = _words.getNumWords();
+
+  // term frequency is the share of the points of a room in a word
+  std::vector<double> tfs(numEntries);
+  std::vector<uint64_t> roomPoints(_roomIds.size(), 0);
+  _entryRooms.resize(numEntries);
+  for (size_t e = 0; e < numEntries; e++) {
+    _entryRooms[e] = roomIndices.at(entryRoomIds[e]);
+    tfs[e] = entryPointOffsets[e + 1] - entryPointOffsets[e];
+    roomPoints[_entryRooms[e]] += tfs[e];
+  }
+
+  // words in fewer rooms are more distinctive
+  std::vector<double> idfs(numWords, 0);
+  std::vector<double> roomNormsSq(_roomIds.size(), 0);
+  for (int w = 0; w < numWords; w++) {
+    uint64_t numRooms = wordEntryOffsets[w + 1] - wordEntryOffsets[w];
+    if (numRooms > 0) {
+      idfs[w] = std::log(static_cast<double>(_roomIds.size()) / numRooms);
+    }
+    for (uint64_t e = wordEntryOffsets[w]; e < wordEntryOffsets[w + 1]; e++) {
+      tfs[e] /= roomPoints[_entryRooms[e]];
+      double weight = tfs[e] * idfs[w];
+      roomNormsSq[_entryRooms[e]] += weight * weight;
     }
   }
 
-  std::map<int, double> sims; // roomId: similarity
-  for (const auto &count : counts) {
-    int roomId = count.first;
-    double sim = static_cast<double>(count.second) /
-                 _rooms.at(roomId).getWordIds().size();
-    sims[roomId] = sim;
-    std::cerr << "roomId = " << roomId << ", similarity = " << sim << std::endl;
+  // a room vector has weights tf * idf, and is normalized. A query vector has
+  // the idf of each of its words, so the cosine similarity is a sum of
+  // tf * idf * idf / norm over query words. The norm of the query does not
+  // change the ranking, so it is left out.
+  _entryWeights.resize(numEntries);
+  for (int w = 0; w < numWords; w++) {
+    for (uint64_t e = wordEntryOffsets[w]; e < wordEntryOffsets[w + 1]; e++) {
+      double norm = std::sqrt(roomNormsSq[_entryRooms[e]]);
+      _entryWeights[e] = norm > 0 ? tfs[e] * idfs[w] * idfs[w] / norm : 0;
+    }
   }
+}
 
-  auto max = std::max_element(
-      sims.begin(), sims.end(),
-      [](const std::pair<int, double> &p1, const std::pair<int, double> &p2) {
-        return p1.second < p2.second;
-      });
+int RoomSearch::search(const std::vector<int> &wordIds) const {
+  std::vector<std::pair<int, float>> results = search(wordIds, 1);
+  if (results.empty()) {
+    return -1;
+  }
+  return results.front().first;
+}
 
-  int roomId = max->first;
-  std::cerr << "max roomId = " << roomId << std::endl;
+std::vector<std::pair<int, float>>
+RoomSearch::search(const std::vector<int> &wordIds, int k) const {
+  assert(k > 0);
 
-  return roomId;
+  // accumulate scores of rooms in the postings of the query words only, in
+  // per-thread buffers that are cleared after the search, so rooms that
+  // share no word with the query cost nothing
+  Scores &buffers = getScores(_roomIds.size());
+  std::vector<float> &scores = buffers.scores;
+  std::vector<char> &isTouched = buffers.isTouched;
+  std::vector<int> touched;
+  Span<const uint64_t> wordEntryOffsets = _words.getWordEntryOffsets();
+  for (int wordId : wordIds) {
+    assert(wordId >= 0 && wordId < _words.getNumWords());
+    for (uint64_t e = wordEntryOffsets[wordId];
+         e < wordEntryOffsets[wordId + 1]; e++) {
+      int room = _entryRooms[e];
+      if (!isTouched[room]) {
+        isTouched[room] = true;
+        touched.emplace_back(room);
+      }
+      scores[room] += _entryWeights[e];
+    }
+  }
+
+  size_t n = std::min(touched.size(), static_cast<size_t>(k));
+  auto byScore = [&](int a, int b) {
+    return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+  };
+  std::partial_sort(touched.begin(), touched.begin() + n, touched.end(),
+                    byScore);
+
+  std::vector<std::pair<int, float>> results;
+  results.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    results.emplace_back(_roomIds[touched[i]], scores[touched[i]]);
+  }
+  for (int room : touched) {
+    scores[room] = 0;
+    isTouched[room] = false;
+  }
+  return results;
 }
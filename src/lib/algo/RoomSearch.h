@@ -1,20 +1,42 @@
 #pragma once
 
 #include "lib/data/Room.h"
-#include "lib/data/Word.h"
+#include "lib/data/WordStore.h"
 #include <memory>
+#include <utility>
+#include <vector>
 
+/**
+ * The inverted file is read-only after construction, and search() keeps its
+ * scores per call, so it is safe to call from several threads.
+ */
 class RoomSearch final {
 public:
+  /**
+   * build an inverted file from each word to the rooms it is in, weighted by
+   * TF-IDF
+   */
   explicit RoomSearch(const std::map<int, Room> &rooms,
-                      const std::map<int, Word> &words);
+                      const WordStore &words);
 
   /**
-   * return the id of the most similar database.
+   * return the id of the most similar database, or -1 if no room shares a
+   * word with the query.
    */
   int search(const std::vector<int> &wordIds) const;
 
+  /**
+   * return at most k (room ID, score) of the most similar rooms, most similar
+   * first. Only rooms that share a word with the query are scored.
+   */
+  std::vector<std::pair<int, float>> search(const std::vector<int> &wordIds,
+                                            int k) const;
+
 private:
-  const std::map<int, Room> &_rooms;
-  const std::map<int, Word> &_words;
+  const WordStore &_words;
+  std::vector<int> _roomIds; // room index: room ID
+  // postings share the word offsets of the word store, entry e is in room
+  // index _entryRooms[e] with weight _entryWeights[e]
+  std::vector<int> _entryRooms;
+  std::vector<float> _entryWeights;
 };
@@ -1,93 +1,87 @@
 #include "lib/algo/Visibility.h"
 #include "lib/data/CameraModel.h"
 #include "lib/data/FoundItem.h"
+#include "lib/data/Image.h"
 #include "lib/data/Label.h"
 #include "lib/data/Transform.h"
-#include "lib/util/Utility.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <opencv2/opencv.hpp>
-#include <pcl/point_types.h>
 
-Visibility::Visibility(const std::map<int, std::vector<Label>> &labels)
-    : _labels(labels) {}
+Visibility::Visibility(const std::map<int, std::vector<Label>> &labels,
+                       const std::map<int, std::map<int, Image>> *images,
+                       float voxelSize, int maxItems, int numThreads)
+    : _maxItems(maxItems) {
+  for (const auto &room : labels) {
+    _indices.emplace(room.first, LabelIndex(room.second));
+    if (images == nullptr || voxelSize <= 0 || room.second.empty()) {
+      continue;
+    }
+    const auto iter = images->find(room.first);
+    if (iter != images->end()) {
+      OccupancyGrid grid(iter->second, voxelSize, OCCUPANCY_DECIMATION,
+                         OCCUPANCY_MIN_POINTS, numThreads);
+      if (!grid.empty()) {
+        _grids.emplace(room.first, std::move(grid));
+      }
+    }
+  }
+}
 
 std::vector<FoundItem> Visibility::process(int dbId, const CameraModel &camera,
                                            const Transform &pose) const {
   std::vector<FoundItem> results;
-  if (_labels.at(dbId).empty()) {
+  const auto iter = _indices.find(dbId);
+  if (iter == _indices.end() || iter->second.size() == 0) {
     return results;
   }
+  const LabelIndex &index = iter->second;
 
-  std::vector<cv::Point3f> points;
-  std::vector<std::string> names;
-  for (auto &label : _labels.at(dbId)) {
-    points.emplace_back(label.getPoint3());
-    names.emplace_back(label.getName());
-  }
-
-  std::cout << "processing transform" << std::endl << pose << std::endl;
-
-  std::vector<cv::Point2f> planePoints;
-
-  cv::Mat K = camera.K();
-  // change the base coordiate of the transform from the world coordinate to the
-  // image coordinate
-  Transform poseInCamera = pose.inverse();
-  cv::Mat R = (cv::Mat_<double>(3, 3) << (double)poseInCamera.r11(),
-               (double)poseInCamera.r12(),
-               (double)poseInCamera.r13(), //
-               (double)poseInCamera.r21(), (double)poseInCamera.r22(),
-               (double)poseInCamera.r23(), //
-               (double)poseInCamera.r31(), (double)poseInCamera.r32(),
-               (double)poseInCamera.r33());
-  cv::Mat rvec(1, 3, CV_64FC1);
-  cv::Rodrigues(R, rvec);
-  cv::Mat tvec = (cv::Mat_<double>(1, 3) << (double)poseInCamera.x(),
-                  (double)poseInCamera.y(), (double)poseInCamera.z());
+  std::vector<LabelIndex::Projection> projections;
+  index.project(camera, pose, projections);
 
-  // do the projection
-  cv::projectPoints(points, rvec, tvec, K, cv::Mat(), planePoints);
-
-  // find points in the image
   int width = camera.getImageSize().width;
   int height = camera.getImageSize().height;
   cv::Point2f center(width / 2, height / 2);
-  std::map<double, std::pair<std::string, cv::Point2f>> resultMap;
-  for (unsigned int i = 0; i < points.size(); ++i) {
-    std::string name = names[i];
-    // if (uIsInBounds(int(planePoints[i].x), 0, width) &&
-    //        uIsInBounds(int(planePoints[i].y), 0, height))
-    if (true) {
-      if (Utility::isInFrontOfCamera(points[i], poseInCamera)) {
-        double dist = cv::norm(planePoints[i] - center);
-        resultMap[dist] =
-            std::pair<std::string, cv::Point2f>(name, planePoints[i]);
-        std::cout << "Find label " << name << " at (" << planePoints[i].x << ","
-                  << planePoints[i].y << ")" << std::endl;
-      } else {
-        std::cout << "Label " << name << " invalid at (" << planePoints[i].x
-                  << "," << planePoints[i].y << ")"
-                  << " because it is from the back of the camera" << std::endl;
-      }
-    } else {
-      std::cout << "label " << name << " invalid at (" << planePoints[i].x
-                << "," << planePoints[i].y << ")" << std::endl;
-    }
+  std::vector<std::pair<double, int>> dists; // distance to center: projection
+  for (unsigned int i = 0; i < projections.size(); i++) {
+    dists.emplace_back(cv::norm(projections[i].point2 - center), i);
+  }
+  std::sort(dists.begin(), dists.end());
+
+  // a label closer to the camera than its margin is never occluded
+  const auto gridIter = _grids.find(dbId);
+  const OccupancyGrid *grid =
+      gridIter == _grids.end() ? nullptr : &gridIter->second;
+  cv::Point3f eye(pose.x(), pose.y(), pose.z());
+  float margin = 0;
+  if (grid != nullptr) {
+    margin = std::max<float>(OCCLUSION_MARGIN, 2 * grid->getVoxelSize());
   }
+
   double size;
   if (width > height) {
     size = height / 10;
   } else {
     size = width / 10;
   }
-  for (std::map<double, std::pair<std::string, cv::Point2f>>::iterator it =
-           resultMap.begin();
-       it != resultMap.end(); ++it) {
-    std::pair<std::string, cv::Point2f> result = it->second;
-    results.push_back(FoundItem(result.first, result.second.x, result.second.y,
-                                size, width, height, dbId));
+  int numOccluded = 0;
+  for (const auto &dist : dists) {
+    if (_maxItems > 0 && results.size() >= static_cast<size_t>(_maxItems)) {
+      break;
+    }
+    const LabelIndex::Projection &projection = projections[dist.second];
+    if (grid != nullptr && grid->isOccluded(eye, projection.point3, margin)) {
+      numOccluded++;
+      continue;
+    }
+    results.push_back(FoundItem(index.getName(projection.nameId),
+                                projection.point2.x, projection.point2.y, size,
+                                width, height, dbId));
   }
+  std::cout << "Found " << results.size() << " of " << index.size()
+            << " labels, " << numOccluded << " occluded" << std::endl;
   return results;
 }
 
@@ -1,25 +1,54 @@
 #pragma once
 
+#include "lib/algo/LabelIndex.h"
+#include "lib/algo/OccupancyGrid.h"
 #include <list>
 #include <map>
 #include <memory>
 #include <numeric>
 #include <vector>
 
+// meters before a label where occupied voxels are its own surface
+#define OCCLUSION_MARGIN 0.3
+// 0 means all visible labels
+#define MAX_ITEMS 0
+
 class CameraModel;
 class Transform;
 class FoundItem;
+class Image;
 class Label;
 
+/**
+ * Projects the labels of a room into an image. Labels are indexed per room
+ * once, so a query only projects the labels in the view frustum. If room
+ * images are given, labels hidden behind the room's surfaces are dropped,
+ * as seen in an occupancy grid built from the depth images. process() only
+ * reads the indexes and may be called concurrently.
+ */
 class Visibility final {
 public:
-  explicit Visibility(const std::map<int, std::vector<Label>> &labels);
+  /*
+   * images are {room ID: {image ID: image}}, and occlusion is not checked if
+   * they are nullptr or voxelSize is 0
+   */
+  explicit Visibility(const std::map<int, std::vector<Label>> &labels,
+                      const std::map<int, std::map<int, Image>> *images =
+                          nullptr,
+                      float voxelSize = OCCUPANCY_VOXEL_SIZE,
+                      int maxItems = MAX_ITEMS, int numThreads = 0);
 
+  /*
+   * the unoccluded labels in the image, nearest to its center first, at most
+   * maxItems of them
+   */
   std::vector<FoundItem> process(int dbId, const CameraModel &camera,
-                                   const Transform &pose) const;
+                                 const Transform &pose) const;
 
 private:
-  const std::map<int, std::vector<Label>> &_labels;
+  std::map<int, LabelIndex> _indices; // room ID: labels
+  std::map<int, OccupancyGrid> _grids; // room ID: occupancy
+  int _maxItems;
 };
 
 struct CompareMeanDist {
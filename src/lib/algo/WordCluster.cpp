@@ -1,24 +1,108 @@
 #include "lib/algo/WordCluster.h"
 #include "lib/util/Utility.h"
+#include <algorithm>
+#include <cfloat>
+#include <memory>
+#include <opencv2/flann.hpp>
 #include <opencv2/opencv.hpp>
 
-WordCluster::WordCluster(float distRatio) : _distRatio(distRatio) {}
+namespace {
+// segments smaller than this are searched by brute force
+const int MIN_INDEXED_WORDS = 64;
+// number of descriptors searched together in one task
+const int CHUNK_SIZE = 64;
 
-std::map<int, Word>
-WordCluster::cluster(const std::vector<int> &roomIds,
-                     const std::vector<cv::Point3f> &points3,
-                     cv::Mat descriptors) {
-  std::map<int, Word> words;
+// the two nearest distinct words of a descriptor, by squared distance
+struct Candidates {
+  Candidates() : dist{FLT_MAX, FLT_MAX}, wordId{-1, -1} {}
 
+  void insert(float d, int w) {
+    if (w == wordId[0]) {
+      dist[0] = std::min(dist[0], d);
+    } else if (w == wordId[1]) {
+      dist[1] = std::min(dist[1], d);
+      if (dist[1] < dist[0]) {
+        std::swap(dist[0], dist[1]);
+        std::swap(wordId[0], wordId[1]);
+      }
+    } else if (d < dist[0]) {
+      dist[1] = dist[0];
+      wordId[1] = wordId[0];
+      dist[0] = d;
+      wordId[0] = w;
+    } else if (d < dist[1]) {
+      dist[1] = d;
+      wordId[1] = w;
+    }
+  }
+
+  float dist[2];
+  int wordId[2];
+};
+
+// a KD-tree over a snapshot of the means of words [begin, end)
+struct Segment {
+  int begin;
+  int end;
+  cv::Mat means;
+  std::unique_ptr<cv::flann::Index> index;
+};
+
+float distSq(const float *a, const float *b, int dim) {
+  float sum = 0;
+  for (int i = 0; i < dim; i++) {
+    float d = a[i] - b[i];
+    sum += d * d;
+  }
+  return sum;
+}
+
+Segment createSegment(const std::vector<float> &means, int dim, int begin,
+                      int end) {
+  Segment segment;
+  segment.begin = begin;
+  segment.end = end;
+  // the KD-tree refers to the data, so it needs its own copy
+  segment.means = cv::Mat(end - begin, dim, CV_32F,
+                          const_cast<float *>(means.data()) + begin * dim)
+                      .clone();
+  if (end - begin >= MIN_INDEXED_WORDS) {
+    segment.index = std::make_unique<cv::flann::Index>(
+        segment.means, cv::flann::KDTreeIndexParams());
+  }
+  return segment;
+}
+} // namespace
+
+WordCluster::WordCluster(float distRatio, int batchSize, int checks,
+                         int numThreads)
+    : _distRatio(distRatio), _batchSize(batchSize), _checks(checks),
+      _numThreads(numThreads) {}
+
+WordStore WordCluster::cluster(const std::vector<int> &roomIds,
+                               const std::vector<cv::Point3f> &points3,
+                               cv::Mat descriptors) {
   assert(roomIds.size() == points3.size());
   assert(roomIds.size() == static_cast<unsigned int>(descriptors.rows));
 
+  if (_batchSize <= 0) {
+    return clusterExact(roomIds, points3, descriptors);
+  }
+
+  std::vector<int> wordIds = assignBatched(descriptors);
+  return WordStore(wordIds, roomIds, points3, descriptors, cv::Mat(),
+                   _numThreads);
+}
+
+WordStore WordCluster::clusterExact(const std::vector<int> &roomIds,
+                                    const std::vector<cv::Point3f> &points3,
+                                    cv::Mat descriptors) {
   const unsigned int k = 2; // k nearest neighbors
   cv::Mat wordDescriptors;  // word Id is the row number
+  std::vector<int> wordIds(descriptors.rows);
 
   cv::BFMatcher matcher;
 
-  int nextWordId = 0;
   for (int i = 0; i < descriptors.rows; i++) {
     Utility::showProgress(static_cast<float>(i + 1) / descriptors.rows);
 
@@ -46,22 +130,153 @@ WordCluster::cluster(const std::vector<int> &roomIds,
 
     int wordId;
     if (newWord) {
-      wordId = nextWordId;
-      nextWordId++;
-      words.emplace(wordId, Word(wordId));
+      // words are matched by their first descriptor, and their means are
+      // computed by the word store
+      wordId = wordDescriptors.rows;
+      wordDescriptors.push_back(descriptors.row(i));
+    } else {
+      wordId = matches.at(0).at(0).trainIdx; // a row of wordDescriptors
+    }
+    wordIds[i] = wordId;
+  }
+  std::cout << std::endl;
+
+  return WordStore(wordIds, roomIds, points3, descriptors, cv::Mat(),
+                   _numThreads);
+}
+
+std::vector<int> WordCluster::assignBatched(const cv::Mat &descriptors) const {
+  assert(descriptors.type() == CV_32F);
+  assert(descriptors.isContinuous());
+
+  const int dim = descriptors.cols;
+  // distances are squared, so is the ratio
+  const float distRatioSq = _distRatio * _distRatio;
+
+  std::vector<int> wordIds(descriptors.rows, -1);
+  std::vector<float> means; // running mean of word w starts at w * dim
+  std::vector<int> counts;  // number of descriptors in each word
+  // segments cover all words created before the current batch, and are merged
+  // like a binary counter, so each word is re-indexed O(log(words)) times with
+  // its latest mean
+  std::vector<Segment> segments;
+
+  auto addToWord = [&](int i, int wordId) {
+    const float *desc = descriptors.ptr<float>(i);
+    if (wordId == static_cast<int>(counts.size())) {
+      means.insert(means.end(), desc, desc + dim);
+      counts.emplace_back(1);
     } else {
-      wordId = matches.at(0).at(0).queryIdx;
+      counts[wordId]++;
+      float *mean = means.data() + wordId * dim;
+      for (int j = 0; j < dim; j++) {
+        mean[j] += (desc[j] - mean[j]) / counts[wordId];
+      }
+    }
+    wordIds[i] = wordId;
+  };
+
+  auto isMatch = [&](const Candidates &candidates) {
+    // NNDR needs two words to compare
+    return candidates.wordId[1] >= 0 &&
+           candidates.dist[0] <= distRatioSq * candidates.dist[1];
+  };
+
+  for (int begin = 0; begin < descriptors.rows; begin += _batchSize) {
+    int end = std::min(descriptors.rows, begin + _batchSize);
+    int batchSize = end - begin;
+
+    // match the batch against words created before it
+    std::vector<Candidates> candidates(batchSize);
+    int numChunks = (batchSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    Utility::parallelFor(0, numChunks, _numThreads, [&](int chunk) {
+      int chunkBegin = chunk * CHUNK_SIZE;
+      int chunkEnd = std::min(batchSize, chunkBegin + CHUNK_SIZE);
+      cv::Mat queries =
+          descriptors.rowRange(begin + chunkBegin, begin + chunkEnd);
+      for (const auto &segment : segments) {
+        if (segment.index != nullptr) {
+          const int k = 2;
+          cv::Mat indices, dists;
+          segment.index->knnSearch(queries, indices, dists, k,
+                                   cv::flann::SearchParams(_checks));
+          for (int i = 0; i < queries.rows; i++) {
+            for (int j = 0; j < k; j++) {
+              int index = indices.at<int>(i, j);
+              if (index >= 0) {
+                candidates[chunkBegin + i].insert(dists.at<float>(i, j),
+                                                  segment.begin + index);
+              }
+            }
+          }
+        } else {
+          for (int i = 0; i < queries.rows; i++) {
+            for (int w = 0; w < segment.means.rows; w++) {
+              candidates[chunkBegin + i].insert(
+                  distSq(queries.ptr<float>(i), segment.means.ptr<float>(w),
+                         dim),
+                  segment.begin + w);
+            }
+          }
+        }
+      }
+    });
+
+    // descriptors without a match may still match words created earlier in
+    // this batch, so they are compared with each other
+    std::vector<int> orphans;
+    for (int i = 0; i < batchSize; i++) {
+      if (isMatch(candidates[i])) {
+        addToWord(begin + i, candidates[i].wordId[0]);
+      } else {
+        orphans.emplace_back(begin + i);
+      }
     }
-    words.at(wordId).addPoint3(roomIds.at(i), points3.at(i),
-                               descriptors.row(i));
-    assert(wordId <= wordDescriptors.rows);
-    if (wordId == wordDescriptors.rows) {
-      wordDescriptors.push_back(words.at(wordId).getMeanDescriptor());
-    } else if (wordId < wordDescriptors.rows) {
-      wordDescriptors.row(wordId) = words.at(wordId).getMeanDescriptor();
+
+    // the two nearest preceding orphans of each orphan
+    std::vector<Candidates> orphanCandidates(orphans.size());
+    auto matchOrphan = [&](int i) {
+      const float *desc = descriptors.ptr<float>(orphans[i]);
+      for (int j = 0; j < i; j++) {
+        orphanCandidates[i].insert(
+            distSq(desc, descriptors.ptr<float>(orphans[j]), dim), j);
+      }
+    };
+    Utility::parallelFor(0, static_cast<int>(orphans.size()), _numThreads,
+                         matchOrphan);
+
+    int segmentEnd = counts.size();
+    for (unsigned int i = 0; i < orphans.size(); i++) {
+      Candidates &c = candidates[orphans[i] - begin];
+      for (int j = 0; j < 2; j++) {
+        int orphan = orphanCandidates[i].wordId[j];
+        if (orphan >= 0) {
+          c.insert(orphanCandidates[i].dist[j], wordIds[orphans[orphan]]);
+        }
+      }
+      int newWordId = counts.size();
+      addToWord(orphans[i], isMatch(c) ? c.wordId[0] : newWordId);
     }
+
+    // index the new words, and merge segments of similar sizes
+    if (static_cast<int>(counts.size()) > segmentEnd) {
+      segments.emplace_back(
+          createSegment(means, dim, segmentEnd, counts.size()));
+    }
+    while (segments.size() >= 2) {
+      const Segment &last = segments[segments.size() - 1];
+      const Segment &prev = segments[segments.size() - 2];
+      if (last.end - last.begin < prev.end - prev.begin) {
+        break;
+      }
+      Segment merged = createSegment(means, dim, prev.begin, last.end);
+      segments.pop_back();
+      segments.back() = std::move(merged);
+    }
+
+    Utility::showProgress(static_cast<float>(end) / descriptors.rows);
   }
   std::cout << std::endl;
 
-  return words;
+  return wordIds;
 }
@@ -1,17 +1,42 @@
 #pragma once
 
-#include "lib/data/Word.h"
+#include "lib/data/WordStore.h"
+#include <vector>
 
 #define DIST_RATIO 0.7
+#define CLUSTER_BATCH_SIZE 0 // 0 means exact incremental clustering
+#define CLUSTER_CHECKS 32
 
 class WordCluster final {
 public:
-  explicit WordCluster(float distRatio = DIST_RATIO);
+  /**
+   * batchSize > 0 selects the approximate parallel clustering: descriptors
+   * are matched batchSize at a time against KD-trees of the word means, which
+   * are refreshed as words are added. Smaller batches and more checks (leaves
+   * visited per KD-tree search) are closer to the exact clustering.
+   * numThreads = 0 means one thread per core.
+   */
+  explicit WordCluster(float distRatio = DIST_RATIO,
+                       int batchSize = CLUSTER_BATCH_SIZE,
+                       int checks = CLUSTER_CHECKS, int numThreads = 0);
 
-  std::map<int, Word> cluster(const std::vector<int> &roomIds,
-                              const std::vector<cv::Point3f> &points3,
-                              cv::Mat descriptors);
+  WordStore cluster(const std::vector<int> &roomIds,
+                    const std::vector<cv::Point3f> &points3,
+                    cv::Mat descriptors);
+
+private:
+  WordStore clusterExact(const std::vector<int> &roomIds,
+                         const std::vector<cv::Point3f> &points3,
+                         cv::Mat descriptors);
+
+  /**
+   * return the word ID of each descriptor
+   */
+  std::vector<int> assignBatched(const cv::Mat &descriptors) const;
 
 private:
   float _distRatio;
+  int _batchSize;
+  int _checks;
+  int _numThreads;
 };
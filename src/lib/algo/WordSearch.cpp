@@ -1,69 +1,85 @@
 #include "lib/algo/WordSearch.h"
+#include "lib/util/Utility.h"
 #include <cassert>
+#include <iostream>
 
-WordSearch::WordSearch(const std::map<int, Word> &words)
-    : _words(words), _type(-1), _dim(-1) {
-  buildIndex();
+WordSearch::WordSearch(const WordStore &words, const AnnParams &params,
+                       const std::string &indexPath)
+    : _words(words), _dataMat(words.getMeanDescriptors()),
+      _index(AnnIndex::create(params)), _indexLoaded(false) {
+  if (_index == nullptr) {
+    std::cerr << "unknown word index type " << params.type
+              << ", using flann instead" << std::endl;
+    AnnParams flannParams = params;
+    flannParams.type = "flann";
+    _index = AnnIndex::create(flannParams);
+  }
+  _indexLoaded = !indexPath.empty() && loadIndex(indexPath);
+  if (!_indexLoaded) {
+    buildIndex();
+  }
 }
 
 std::vector<int> WordSearch::search(const cv::Mat &descriptors) const {
-  const int k = 1;
   std::vector<int> resultIds(descriptors.rows, 0);
 
-  if (_words.size() > 0 && descriptors.rows > 0) {
-    // verify we have the same features
-    assert(_type == descriptors.type());
-    assert(_dim == descriptors.cols);
-
-    cv::Mat indices;
-    cv::Mat dists;
-    if (_index != nullptr) {
-      // Find nearest neighbors
-      indices.create(descriptors.rows, k, CV_32S);
-      dists.create(descriptors.rows, k, CV_32F);
+  cv::Mat indices;
+  cv::Mat dists;
+  search(descriptors, indices, dists, 1);
+  for (int i = 0; i < indices.rows; ++i) {
+    resultIds[i] = indices.at<int>(i, 0);
+  }
 
-      _index->knnSearch(descriptors, indices, dists, k);
-    }
+  return resultIds;
+}
 
-    assert(dists.rows == descriptors.rows && dists.cols == k);
-    for (int i = 0; i < descriptors.rows; ++i) {
-      float d = dists.at<float>(i, 0);
-      int id = _mapIndexId.at(indices.at<int>(i, 0));
-      assert(d >= 0.0f);
-      resultIds[i] = id;
-    }
+void WordSearch::search(const cv::Mat &descriptors, cv::Mat &wordIds,
+                        cv::Mat &dists, int k) const {
+  if (_words.getNumWords() == 0 || descriptors.rows == 0) {
+    wordIds.release();
+    dists.release();
+    return;
   }
 
-  return resultIds;
+  // verify we have the same features
+  assert(_words.getDescType() == descriptors.type());
+  assert(_words.getDescDim() == descriptors.cols);
+
+  _index->knnSearch(descriptors, wordIds, dists, k);
+  assert(wordIds.rows == descriptors.rows && wordIds.cols == k);
 }
 
-void WordSearch::buildIndex() {
-  _mapIndexId.clear();
-  _dataMat = cv::Mat();
+const std::string &WordSearch::getAnnType() const { return _index->getType(); }
 
-  if (_words.size() > 0) {
-    // use the first word to define the type and dim
-    if (_type < 0 || _dim < 0) {
-      const cv::Mat &descriptor = _words.begin()->second.getMeanDescriptor();
-      _type = descriptor.type();
-      _dim = descriptor.cols;
-    }
+bool WordSearch::isIndexLoaded() const { return _indexLoaded; }
 
-    // Create the data matrix
-    _dataMat = cv::Mat(_words.size(), _dim, _type);
-    int i = 0;
-    for (const auto &word : _words) {
-      const cv::Mat &descriptor = word.second.getMeanDescriptor();
+bool WordSearch::saveIndex(const std::string &indexPath) const {
+  if (_dataMat.empty()) {
+    return false;
+  }
+  return _index->save(indexPath);
+}
 
-      assert(descriptor.type() == _type);
-      assert(descriptor.cols == _dim);
+void WordSearch::buildIndex() {
+  if (_dataMat.empty()) {
+    return;
+  }
+  long startTime = Utility::getTime();
+  _index->build(_dataMat);
+  long buildTime = Utility::getTime() - startTime;
+  std::cout << "Time " << _index->getType() << " word index " << buildTime
+            << " ms" << std::endl;
+}
 
-      descriptor.copyTo(_dataMat.row(i));
-      _mapIndexId.insert(_mapIndexId.end(), std::make_pair(i, word.first));
-      i++;
-    }
+bool WordSearch::loadIndex(const std::string &indexPath) {
+  if (_dataMat.empty()) {
+    return false;
+  }
 
-    _index = std::make_unique<cv::flann::Index>(_dataMat,
-                                                cv::flann::KDTreeIndexParams());
+  // the index stores row numbers of _dataMat, which are word IDs
+  if (!_index->load(_dataMat, indexPath)) {
+    std::cerr << "could not load word index from " << indexPath << std::endl;
+    return false;
   }
+  return true;
 }
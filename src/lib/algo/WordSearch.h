@@ -1,23 +1,44 @@
 #pragma once
 
-#include "lib/data/Word.h"
+#include "lib/algo/ann/AnnIndex.h"
+#include "lib/data/WordStore.h"
 #include <memory>
-#include <opencv2/flann.hpp>
+#include <string>
+#include <vector>
 
+/**
+ * Finds the nearest word of descriptors. The index is not modified after it
+ * is built or loaded, so searches may run concurrently.
+ */
 class WordSearch final {
 public:
-  explicit WordSearch(const std::map<int, Word> &words);
+  // the index is loaded from indexPath if possible, otherwise it is built
+  explicit WordSearch(const WordStore &words,
+                      const AnnParams &params = AnnParams(),
+                      const std::string &indexPath = "");
 
   std::vector<int> search(const cv::Mat &descriptors) const;
 
+  /**
+   * the k nearest word IDs (-1 if not found) and squared distances of each
+   * descriptor, nearest first
+   */
+  void search(const cv::Mat &descriptors, cv::Mat &wordIds, cv::Mat &dists,
+              int k) const;
+
+  const std::string &getAnnType() const;
+  bool isIndexLoaded() const;
+
+  bool saveIndex(const std::string &indexPath) const;
+
 private:
   void buildIndex();
+  bool loadIndex(const std::string &indexPath);
 
 private:
-  const std::map<int, Word> &_words;
-  int _type;
-  int _dim;
+  const WordStore &_words;
+  // row w is the mean descriptor of word w, so row numbers are word IDs
   cv::Mat _dataMat;
-  std::unique_ptr<cv::flann::Index> _index;
-  std::map<int, int> _mapIndexId; // (row num, word id)
+  std::unique_ptr<AnnIndex> _index;
+  bool _indexLoaded;
 };
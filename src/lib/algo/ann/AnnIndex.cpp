@@ -0,0 +1,16 @@
+#include "lib/algo/ann/AnnIndex.h"
+#include "lib/algo/ann/BruteForceIndex.h"
+#include "lib/algo/ann/FlannIndex.h"
+#include "lib/algo/ann/HnswIndex.h"
+
+std::unique_ptr<AnnIndex> AnnIndex::create(const AnnParams &params) {
+  if (params.type == "flann") {
+    return std::make_unique<FlannIndex>(params.flannTrees, params.flannChecks);
+  } else if (params.type == "hnsw") {
+    return std::make_unique<HnswIndex>(params.hnswM, params.hnswEfConstruction,
+                                       params.hnswEf, params.numThreads);
+  } else if (params.type == "brute") {
+    return std::make_unique<BruteForceIndex>();
+  }
+  return nullptr;
+}
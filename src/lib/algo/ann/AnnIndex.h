@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <opencv2/core/core.hpp>
+#include <string>
+
+#define ANN_TYPE "flann"
+#define FLANN_TREES 4
+#define FLANN_CHECKS 32
+#define HNSW_M 16
+#define HNSW_EF_CONSTRUCTION 200
+#define HNSW_EF 64
+
+/**
+ * type is one of "flann", "hnsw" or "brute"
+ */
+struct AnnParams {
+  std::string type = ANN_TYPE;
+  int flannTrees = FLANN_TREES;
+  int flannChecks = FLANN_CHECKS;
+  int hnswM = HNSW_M;
+  int hnswEfConstruction = HNSW_EF_CONSTRUCTION;
+  int hnswEf = HNSW_EF;
+  int numThreads = 0; // used to build the index, 0 means one per core
+};
+
+/**
+ * An index for k nearest neighbor search of CV_32F rows by L2 distance
+ */
+class AnnIndex {
+public:
+  virtual ~AnnIndex() = default;
+
+  /**
+   * return nullptr if the type is unknown
+   */
+  static std::unique_ptr<AnnIndex> create(const AnnParams &params);
+
+  virtual const std::string &getType() const = 0;
+
+  /**
+   * the data is referred to, not copied, so it must outlive the index
+   */
+  virtual void build(const cv::Mat &data) = 0;
+
+  /**
+   * load an index saved for the same data
+   */
+  virtual bool load(const cv::Mat &data, const std::string &path) = 0;
+
+  virtual bool save(const std::string &path) const = 0;
+
+  /**
+   * indices (CV_32S) and squared distances (CV_32F) of the k nearest rows of
+   * each query row, nearest first. Indices are -1 if fewer are found.
+   * Must be thread safe.
+   */
+  virtual void knnSearch(const cv::Mat &queries, cv::Mat &indices,
+                         cv::Mat &dists, int k) const = 0;
+};
@@ -0,0 +1,51 @@
+#include "lib/algo/ann/BruteForceIndex.h"
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+
+BruteForceIndex::BruteForceIndex() {}
+
+const std::string &BruteForceIndex::getType() const {
+  static const std::string type = "brute";
+  return type;
+}
+
+void BruteForceIndex::build(const cv::Mat &data) { _data = data; }
+
+bool BruteForceIndex::load(const cv::Mat &data, const std::string &path) {
+  // there is nothing to load, but the saved row count must match
+  std::ifstream in(path, std::ios::binary);
+  int rows = -1;
+  in.read(reinterpret_cast<char *>(&rows), sizeof(rows));
+  if (!in || rows != data.rows) {
+    return false;
+  }
+  _data = data;
+  return true;
+}
+
+bool BruteForceIndex::save(const std::string &path) const {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  int rows = _data.rows;
+  out.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+  return static_cast<bool>(out);
+}
+
+void BruteForceIndex::knnSearch(const cv::Mat &queries, cv::Mat &indices,
+                                cv::Mat &dists, int k) const {
+  indices.create(queries.rows, k, CV_32S);
+  dists.create(queries.rows, k, CV_32F);
+  indices.setTo(-1);
+  dists.setTo(FLT_MAX);
+  if (_data.empty() || queries.empty()) {
+    return;
+  }
+
+  // batchDistance finds at most as many neighbors as there are rows
+  int n = std::min(k, _data.rows);
+  cv::Mat nearestIndices, nearestDists;
+  cv::batchDistance(queries, _data, nearestDists, CV_32F, nearestIndices,
+                    cv::NORM_L2SQR, n);
+  nearestIndices.copyTo(indices.colRange(0, n));
+  nearestDists.copyTo(dists.colRange(0, n));
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "lib/algo/ann/AnnIndex.h"
+
+/**
+ * Exact search, comparing each query with all rows
+ */
+class BruteForceIndex final : public AnnIndex {
+public:
+  explicit BruteForceIndex();
+
+  const std::string &getType() const final;
+  void build(const cv::Mat &data) final;
+  bool load(const cv::Mat &data, const std::string &path) final;
+  bool save(const std::string &path) const final;
+  void knnSearch(const cv::Mat &queries, cv::Mat &indices, cv::Mat &dists,
+                 int k) const final;
+
+private:
+  cv::Mat _data;
+};
@@ -0,0 +1,70 @@
+#include "lib/algo/ann/FlannIndex.h"
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace {
+// appended to the file FLANN writes, which it ignores when loading
+struct Trailer {
+  char magic[4];
+  int32_t trees;
+};
+
+const char MAGIC[4] = {'F', 'L', 'N', 'T'};
+} // namespace
+
+FlannIndex::FlannIndex(int trees, int checks)
+    : _trees(trees), _checks(checks) {}
+
+const std::string &FlannIndex::getType() const {
+  static const std::string type = "flann";
+  return type;
+}
+
+void FlannIndex::build(const cv::Mat &data) {
+  _index = std::make_unique<cv::flann::Index>(
+      data, cv::flann::KDTreeIndexParams(_trees));
+}
+
+bool FlannIndex::load(const cv::Mat &data, const std::string &path) {
+  // a forest of another number of trees is rebuilt
+  std::ifstream in(path, std::ios::binary);
+  Trailer trailer;
+  in.seekg(-static_cast<std::streamoff>(sizeof(Trailer)), std::ios::end);
+  in.read(reinterpret_cast<char *>(&trailer), sizeof(Trailer));
+  if (!in || memcmp(trailer.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      trailer.trees != _trees) {
+    return false;
+  }
+
+  auto index = std::make_unique<cv::flann::Index>();
+  if (!index->load(data, path)) {
+    return false;
+  }
+  _index = std::move(index);
+  return true;
+}
+
+bool FlannIndex::save(const std::string &path) const {
+  if (_index == nullptr) {
+    return false;
+  }
+  _index->save(path);
+
+  Trailer trailer;
+  memcpy(trailer.magic, MAGIC, sizeof(MAGIC));
+  trailer.trees = _trees;
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  out.write(reinterpret_cast<const char *>(&trailer), sizeof(Trailer));
+  return static_cast<bool>(out);
+}
+
+void FlannIndex::knnSearch(const cv::Mat &queries, cv::Mat &indices,
+                           cv::Mat &dists, int k) const {
+  assert(_index != nullptr);
+  indices.create(queries.rows, k, CV_32S);
+  dists.create(queries.rows, k, CV_32F);
+  _index->knnSearch(queries, indices, dists, k,
+                    cv::flann::SearchParams(_checks));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "lib/algo/ann/AnnIndex.h"
+#include <opencv2/flann.hpp>
+
+/**
+ * A FLANN forest of randomized KD-trees
+ */
+class FlannIndex final : public AnnIndex {
+public:
+  explicit FlannIndex(int trees = FLANN_TREES, int checks = FLANN_CHECKS);
+
+  const std::string &getType() const final;
+  void build(const cv::Mat &data) final;
+  bool load(const cv::Mat &data, const std::string &path) final;
+  bool save(const std::string &path) const final;
+  void knnSearch(const cv::Mat &queries, cv::Mat &indices, cv::Mat &dists,
+                 int k) const final;
+
+private:
+  int _trees;
+  int _checks;
+  std::unique_ptr<cv::flann::Index> _index;
+};
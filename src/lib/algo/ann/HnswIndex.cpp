@@ -0,0 +1,411 @@
+#include "lib/algo/ann/HnswIndex.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <random>
+
+namespace {
+const char MAGIC[4] = {'H', 'N', 'S', 'W'};
+const int32_t VERSION = 2;
+const int MAX_LEVEL = 32;
+
+// marks the nodes visited by one search, without clearing all marks each time
+class VisitedSet final {
+public:
+  void reset(size_t size) {
+    if (_marks.size() != size || _tag == UINT32_MAX) {
+      _marks.assign(size, 0);
+      _tag = 0;
+    }
+    _tag++;
+  }
+
+  // return false if the node was visited already
+  bool visit(int node) {
+    if (_marks[node] == _tag) {
+      return false;
+    }
+    _marks[node] = _tag;
+    return true;
+  }
+
+private:
+  std::vector<uint32_t> _marks;
+  uint32_t _tag = 0;
+};
+
+VisitedSet &getVisitedSet() {
+  thread_local VisitedSet visited;
+  return visited;
+}
+
+template <class T>
+void writeVector(std::ostream &out, const std::vector<T> &v) {
+  out.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+template <class T> void readVector(std::istream &in, std::vector<T> &v) {
+  in.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+}
+} // namespace
+
+HnswIndex::HnswIndex(int m, int efConstruction, int ef, int numThreads)
+    : _m(std::max(m, 2)), _efConstruction(std::max(efConstruction, m)),
+      _ef(ef), _numThreads(numThreads), _entryPoint(-1), _maxLevel(-1) {}
+
+const std::string &HnswIndex::getType() const {
+  static const std::string type = "hnsw";
+  return type;
+}
+
+void HnswIndex::build(const cv::Mat &data) {
+  assert(data.type() == CV_32F);
+  _data = data;
+  const int n = data.rows;
+
+  // levels are drawn up front, so they don't depend on the insertion order
+  std::mt19937 rng(100);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double levelMult = 1 / std::log(static_cast<double>(_m));
+  _levels.resize(n);
+  _upperLinks.assign(n, std::vector<int>());
+  for (int i = 0; i < n; i++) {
+    double level = -std::log(1.0 - uniform(rng)) * levelMult;
+    _levels[i] = std::min(static_cast<int>(level), MAX_LEVEL);
+    _upperLinks[i].assign(_levels[i] * (_m + 1), 0);
+  }
+  _links0.assign(static_cast<size_t>(n) * (2 * _m + 1), 0);
+
+  _entryPoint = -1;
+  _maxLevel = -1;
+  if (n == 0) {
+    return;
+  }
+  _entryPoint = 0;
+  _maxLevel = _levels[0];
+
+  _nodeMutexes.reset(new std::mutex[n]);
+  Utility::parallelFor(1, n, _numThreads, [this](int i) { insert(i); });
+  _nodeMutexes.reset();
+}
+
+bool HnswIndex::load(const cv::Mat &data, const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  char magic[4];
+  int32_t version;
+  // rows, cols, m, ef construction, entry point, max level
+  int32_t header[6];
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char *>(&version), sizeof(version));
+  in.read(reinterpret_cast<char *>(header), sizeof(header));
+  // a graph built with other parameters is rebuilt
+  if (!in || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION ||
+      header[0] != data.rows || header[1] != data.cols || header[2] != _m ||
+      header[3] != _efConstruction || header[4] < 0 ||
+      header[4] >= data.rows || header[5] < 0 || header[5] > MAX_LEVEL) {
+    return false;
+  }
+  const int n = header[0];
+  const int m = header[2];
+
+  std::vector<int> levels(n);
+  readVector(in, levels);
+  std::vector<int> links0(static_cast<size_t>(n) * (2 * m + 1));
+  readVector(in, links0);
+  std::vector<std::vector<int>> upperLinks(n);
+  for (int i = 0; i < n && in; i++) {
+    if (levels[i] < 0 || levels[i] > MAX_LEVEL) {
+      return false;
+    }
+    upperLinks[i].resize(levels[i] * (m + 1));
+    readVector(in, upperLinks[i]);
+  }
+  if (!in || levels[header[4]] != header[5]) {
+    return false;
+  }
+
+  // searches follow links without checks, so a link must be to a node on
+  // its level
+  auto isValid = [&](const int *links, int maxLinks, int level) {
+    if (links[0] < 0 || links[0] > maxLinks) {
+      return false;
+    }
+    for (int j = 1; j <= links[0]; j++) {
+      if (links[j] < 0 || links[j] >= n || levels[links[j]] < level) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (int i = 0; i < n; i++) {
+    if (!isValid(&links0[static_cast<size_t>(i) * (2 * m + 1)], 2 * m, 0)) {
+      return false;
+    }
+    for (int level = 1; level <= levels[i]; level++) {
+      if (!isValid(&upperLinks[i][(level - 1) * (m + 1)], m, level)) {
+        return false;
+      }
+    }
+  }
+
+  _data = data;
+  _entryPoint = header[4];
+  _maxLevel = header[5];
+  _levels = std::move(levels);
+  _links0 = std::move(links0);
+  _upperLinks = std::move(upperLinks);
+  return true;
+}
+
+bool HnswIndex::save(const std::string &path) const {
+  if (_entryPoint < 0) {
+    return false;
+  }
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  int32_t header[6] = {_data.rows,      _data.cols,  _m,
+                       _efConstruction, _entryPoint, _maxLevel};
+  out.write(MAGIC, sizeof(MAGIC));
+  out.write(reinterpret_cast<const char *>(&VERSION), sizeof(VERSION));
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  writeVector(out, _levels);
+  writeVector(out, _links0);
+  for (const auto &links : _upperLinks) {
+    writeVector(out, links);
+  }
+  return static_cast<bool>(out);
+}
+
+void HnswIndex::knnSearch(const cv::Mat &queries, cv::Mat &indices,
+                          cv::Mat &dists, int k) const {
+  assert(queries.type() == CV_32F && queries.cols == _data.cols);
+  indices.create(queries.rows, k, CV_32S);
+  dists.create(queries.rows, k, CV_32F);
+  indices.setTo(-1);
+  dists.setTo(FLT_MAX);
+  if (_entryPoint < 0) {
+    return;
+  }
+
+  for (int i = 0; i < queries.rows; i++) {
+    const float *query = queries.ptr<float>(i);
+    int entry = _entryPoint;
+    for (int level = _maxLevel; level > 0; level--) {
+      entry = searchGreedy(query, entry, level);
+    }
+    std::vector<Candidate> nearest =
+        searchLayer(query, entry, std::max(_ef, k), 0);
+    for (int j = 0; j < k && j < static_cast<int>(nearest.size()); j++) {
+      dists.at<float>(i, j) = nearest[j].first;
+      indices.at<int>(i, j) = nearest[j].second;
+    }
+  }
+}
+
+float HnswIndex::distance(const float *query, int node) const {
+  const float *row = _data.ptr<float>(node);
+  const int dim = _data.cols;
+  // independent sums, so that the compiler can keep several in flight
+  float sums[4] = {0, 0, 0, 0};
+  int i = 0;
+  for (; i + 4 <= dim; i += 4) {
+    for (int j = 0; j < 4; j++) {
+      float d = query[i + j] - row[i + j];
+      sums[j] += d * d;
+    }
+  }
+  for (; i < dim; i++) {
+    float d = query[i] - row[i];
+    sums[0] += d * d;
+  }
+  return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+int *HnswIndex::getLinks(int node, int level) {
+  if (level == 0) {
+    return &_links0[static_cast<size_t>(node) * (2 * _m + 1)];
+  }
+  return &_upperLinks[node][(level - 1) * (_m + 1)];
+}
+
+const int *HnswIndex::getLinks(int node, int level) const {
+  if (level == 0) {
+    return &_links0[static_cast<size_t>(node) * (2 * _m + 1)];
+  }
+  return &_upperLinks[node][(level - 1) * (_m + 1)];
+}
+
+int HnswIndex::getMaxLinks(int level) const {
+  return level == 0 ? 2 * _m : _m;
+}
+
+std::unique_lock<std::mutex> HnswIndex::lockNode(int node) const {
+  if (_nodeMutexes == nullptr) {
+    return std::unique_lock<std::mutex>();
+  }
+  return std::unique_lock<std::mutex>(_nodeMutexes[node]);
+}
+
+int HnswIndex::searchGreedy(const float *query, int entry, int level) const {
+  int current = entry;
+  float currentDist = distance(query, current);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    auto lock = lockNode(current);
+    const int *links = getLinks(current, level);
+    for (int i = 1; i <= links[0]; i++) {
+      float dist = distance(query, links[i]);
+      if (dist < currentDist) {
+        currentDist = dist;
+        current = links[i];
+        changed = true;
+      }
+    }
+  }
+  return current;
+}
+
+std::vector<HnswIndex::Candidate>
+HnswIndex::searchLayer(const float *query, int entry, int ef,
+                       int level) const {
+  VisitedSet &visited = getVisitedSet();
+  visited.reset(_levels.size());
+
+  // nearest candidate on top
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>>
+      candidates;
+  // farthest result on top
+  std::priority_queue<Candidate> results;
+
+  float entryDist = distance(query, entry);
+  visited.visit(entry);
+  candidates.emplace(entryDist, entry);
+  results.emplace(entryDist, entry);
+
+  std::vector<int> neighbors;
+  while (!candidates.empty()) {
+    Candidate candidate = candidates.top();
+    if (candidate.first > results.top().first) {
+      break;
+    }
+    candidates.pop();
+
+    {
+      auto lock = lockNode(candidate.second);
+      const int *links = getLinks(candidate.second, level);
+      neighbors.assign(links + 1, links + 1 + links[0]);
+    }
+    for (int neighbor : neighbors) {
+      if (!visited.visit(neighbor)) {
+        continue;
+      }
+      float dist = distance(query, neighbor);
+      if (static_cast<int>(results.size()) < ef || dist < results.top().first) {
+        candidates.emplace(dist, neighbor);
+        results.emplace(dist, neighbor);
+        if (static_cast<int>(results.size()) > ef) {
+          results.pop();
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> nearest(results.size());
+  for (size_t i = nearest.size(); i > 0; i--) {
+    nearest[i - 1] = results.top();
+    results.pop();
+  }
+  return nearest;
+}
+
+std::vector<int>
+HnswIndex::selectNeighbors(const std::vector<Candidate> &candidates,
+                           int m) const {
+  std::vector<int> selected;
+  for (const auto &candidate : candidates) {
+    if (static_cast<int>(selected.size()) >= m) {
+      break;
+    }
+    const float *row = _data.ptr<float>(candidate.second);
+    bool keep = true;
+    for (int node : selected) {
+      if (distance(row, node) < candidate.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      selected.emplace_back(candidate.second);
+    }
+  }
+  return selected;
+}
+
+void HnswIndex::insert(int node) {
+  const float *query = _data.ptr<float>(node);
+  const int level = _levels[node];
+
+  // a node above the top level becomes the entry point, so the entry point
+  // stays locked until it is linked
+  std::unique_lock<std::mutex> entryLock(_entryMutex);
+  int entry = _entryPoint;
+  int maxLevel = _maxLevel;
+  if (level <= maxLevel) {
+    entryLock.unlock();
+  }
+
+  for (int l = maxLevel; l > level; l--) {
+    entry = searchGreedy(query, entry, l);
+  }
+  for (int l = std::min(level, maxLevel); l >= 0; l--) {
+    std::vector<Candidate> candidates =
+        searchLayer(query, entry, _efConstruction, l);
+    std::vector<int> neighbors = selectNeighbors(candidates, _m);
+    {
+      auto lock = lockNode(node);
+      int *links = getLinks(node, l);
+      links[0] = neighbors.size();
+      std::copy(neighbors.begin(), neighbors.end(), links + 1);
+    }
+    for (int neighbor : neighbors) {
+      link(neighbor, node, l);
+    }
+    entry = candidates.front().second;
+  }
+
+  if (level > maxLevel) {
+    _entryPoint = node;
+    _maxLevel = level;
+  }
+}
+
+void HnswIndex::link(int node, int neighbor, int level) {
+  auto lock = lockNode(node);
+  int *links = getLinks(node, level);
+  const int maxLinks = getMaxLinks(level);
+  if (links[0] < maxLinks) {
+    links[links[0] + 1] = neighbor;
+    links[0]++;
+    return;
+  }
+
+  // the node is full, so its links are selected again with the new one
+  const float *row = _data.ptr<float>(node);
+  std::vector<Candidate> candidates;
+  candidates.emplace_back(distance(row, neighbor), neighbor);
+  for (int i = 1; i <= links[0]; i++) {
+    candidates.emplace_back(distance(row, links[i]), links[i]);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  std::vector<int> selected = selectNeighbors(candidates, maxLinks);
+  links[0] = selected.size();
+  std::copy(selected.begin(), selected.end(), links + 1);
+}
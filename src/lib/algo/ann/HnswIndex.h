@@ -0,0 +1,71 @@
+#pragma once
+
+#include "lib/algo/ann/AnnIndex.h"
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * A hierarchical navigable small world graph (Malkov and Yashunin). Each row
+ * is a node on levels [0, level], linked to at most m neighbors on each level
+ * above 0 and 2m neighbors on level 0. A search descends greedily from the
+ * top level, and keeps the ef nearest candidates on level 0, so ef trades
+ * recall for speed.
+ */
+class HnswIndex final : public AnnIndex {
+public:
+  explicit HnswIndex(int m = HNSW_M, int efConstruction = HNSW_EF_CONSTRUCTION,
+                     int ef = HNSW_EF, int numThreads = 0);
+
+  const std::string &getType() const final;
+  void build(const cv::Mat &data) final;
+  bool load(const cv::Mat &data, const std::string &path) final;
+  bool save(const std::string &path) const final;
+  void knnSearch(const cv::Mat &queries, cv::Mat &indices, cv::Mat &dists,
+                 int k) const final;
+
+private:
+  typedef std::pair<float, int> Candidate; // (squared distance, node)
+
+  float distance(const float *query, int node) const;
+
+  // [count, neighbors...] of a node on a level
+  int *getLinks(int node, int level);
+  const int *getLinks(int node, int level) const;
+  int getMaxLinks(int level) const;
+
+  // lock the links of a node while the graph is being built
+  std::unique_lock<std::mutex> lockNode(int node) const;
+
+  int searchGreedy(const float *query, int entry, int level) const;
+
+  /**
+   * return the ef nearest nodes found from entry on a level, nearest first
+   */
+  std::vector<Candidate> searchLayer(const float *query, int entry, int ef,
+                                     int level) const;
+
+  /**
+   * keep at most m candidates, skipping those closer to a kept one than to
+   * the query, so that links spread in all directions
+   */
+  std::vector<int> selectNeighbors(const std::vector<Candidate> &candidates,
+                                   int m) const;
+
+  void insert(int node);
+  void link(int node, int neighbor, int level);
+
+private:
+  int _m;
+  int _efConstruction;
+  int _ef;
+  int _numThreads;
+  cv::Mat _data;
+  int _entryPoint;
+  int _maxLevel;
+  std::vector<int> _levels;
+  std::vector<int> _links0;                  // level 0, 2m + 1 ints per node
+  std::vector<std::vector<int>> _upperLinks; // levels above 0, m + 1 each
+  std::unique_ptr<std::mutex[]> _nodeMutexes; // only while building
+  std::mutex _entryMutex;
+};
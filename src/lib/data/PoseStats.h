@@ -0,0 +1,18 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * How well an estimated pose is supported by the 2D-3D correspondences it was
+ * estimated from
+ */
+struct PoseStats {
+  int correspondences = 0;
+  int inliers = 0;
+  int iterations = 0; // 0 if the PnP type does not report them
+  double rms = 0;     // reprojection error of the inliers, in pixels
+
+  // 6x6 CV_64F covariance of the rotation vector and translation that map
+  // world points into the camera frame, empty if unknown
+  cv::Mat covariance;
+};
@@ -1,6 +1,5 @@
 #pragma once
 
-#include "lib/data/Word.h"
 #include <map>
 #include <opencv2/core/core.hpp>
 #include <set>
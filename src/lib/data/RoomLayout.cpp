@@ -0,0 +1,41 @@
+#include "lib/data/RoomLayout.h"
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+RoomLayout::RoomLayout(int roomId, int numWords,
+                       const std::vector<int> &wordIds,
+                       std::vector<uint64_t> &&entries)
+    : _roomId(roomId), _bitmap((numWords + 63) / 64, 0),
+      _ranks(_bitmap.size(), 0), _entries(std::move(entries)) {
+  assert(wordIds.size() == _entries.size());
+  for (int wordId : wordIds) {
+    assert(wordId >= 0 && wordId < numWords);
+    _bitmap[wordId / 64] |= 1ULL << (wordId % 64);
+  }
+  uint32_t rank = 0;
+  for (size_t i = 0; i < _bitmap.size(); i++) {
+    _ranks[i] = rank;
+    rank += __builtin_popcountll(_bitmap[i]);
+  }
+  assert(rank == _entries.size());
+}
+
+int RoomLayout::getRoomId() const { return _roomId; }
+
+int RoomLayout::getNumWords() const { return _entries.size(); }
+
+bool RoomLayout::hasWord(int wordId) const {
+  if (wordId < 0 || static_cast<size_t>(wordId / 64) >= _bitmap.size()) {
+    return false;
+  }
+  return (_bitmap[wordId / 64] >> (wordId % 64)) & 1;
+}
+
+long RoomLayout::getEntry(int wordId) const {
+  if (!hasWord(wordId)) {
+    return -1;
+  }
+  uint64_t below = _bitmap[wordId / 64] & ((1ULL << (wordId % 64)) - 1);
+  return _entries[_ranks[wordId / 64] + __builtin_popcountll(below)];
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * The words of a room, as a bitmap over all word IDs. The i-th word set in
+ * the bitmap has its points and descriptors in the room in word store entry
+ * i, which are contiguous, so lookups need no copy and no tree.
+ */
+class RoomLayout final {
+public:
+  /*
+   * wordIds are ascending, and entries[i] is the entry of wordIds[i] in the
+   * room
+   */
+  explicit RoomLayout(int roomId, int numWords,
+                      const std::vector<int> &wordIds,
+                      std::vector<uint64_t> &&entries);
+
+  int getRoomId() const;
+  int getNumWords() const;
+  bool hasWord(int wordId) const;
+
+  /*
+   * return the word store entry of a word in the room, or -1 if the word is
+   * not in it
+   */
+  long getEntry(int wordId) const;
+
+private:
+  int _roomId;
+  std::vector<uint64_t> _bitmap; // bit w is set if word w is in the room
+  std::vector<uint32_t> _ranks;  // number of bits set before each block
+  std::vector<uint64_t> _entries;
+};
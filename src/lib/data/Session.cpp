@@ -0,0 +1,64 @@
+#include "lib/data/Session.h"
+#include <algorithm>
+
+namespace {
+// how far a motion may be extrapolated, in multiples of the last motion
+const float MAX_EXTRAPOLATION = 2.0f;
+} // namespace
+
+Session::Session() : _roomId(-1), _lastTime(0), _prevTime(0) {}
+
+bool Session::predictPose(long time, long timeout, int &roomId,
+                          Transform &pose) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (timeout <= 0 || _lastPose.isNull() || time - _lastTime > timeout) {
+    return false;
+  }
+
+  roomId = _roomId;
+  if (_prevPose.isNull() || _lastTime <= _prevTime) {
+    pose = _lastPose;
+    return true;
+  }
+
+  // the last motion in the camera frame, scaled to the time since then
+  float ratio = static_cast<float>(time - _lastTime) / (_lastTime - _prevTime);
+  ratio = std::max(0.0f, std::min(ratio, MAX_EXTRAPOLATION));
+  Eigen::Affine3f motion = (_prevPose.inverse() * _lastPose).toEigen3f();
+  Eigen::AngleAxisf rotation(motion.rotation());
+  rotation.angle() *= ratio;
+  Eigen::Matrix3f r = rotation.toRotationMatrix();
+  Eigen::Vector3f t = motion.translation() * ratio;
+  Transform scaled(r(0, 0), r(0, 1), r(0, 2), t(0), //
+                   r(1, 0), r(1, 1), r(1, 2), t(1), //
+                   r(2, 0), r(2, 1), r(2, 2), t(2));
+  pose = _lastPose * scaled;
+  return true;
+}
+
+void Session::update(int roomId, const Transform &pose, long time) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (time < _lastTime) {
+    return;
+  }
+  if (roomId == _roomId && !_lastPose.isNull()) {
+    _prevPose = _lastPose;
+    _prevTime = _lastTime;
+  } else {
+    _prevPose = Transform();
+  }
+  _roomId = roomId;
+  _lastPose = pose;
+  _lastTime = time;
+}
+
+void Session::reset(long time) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (time < _lastTime) {
+    return;
+  }
+  _roomId = -1;
+  _lastPose = Transform();
+  _lastTime = time;
+  _prevPose = Transform();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "lib/data/Transform.h"
+#include <mutex>
+
+/**
+ * The tracking state of one client stream: the room and the last two poses
+ * it was localized at. The next pose is predicted from them with a constant
+ * velocity model. Frames of a stream may be localized concurrently and
+ * finish out of order, so a session is locked, and a frame older than the
+ * last one it has seen does not change it.
+ */
+class Session final {
+public:
+  explicit Session();
+
+  /**
+   * if the last frame was localized at most timeout ms before time, get its
+   * room and the pose at time, extrapolated from the last two poses in the
+   * same room, or the last pose if there is only one
+   */
+  bool predictPose(long time, long timeout, int &roomId,
+                   Transform &pose) const;
+
+  /**
+   * time is when the frame arrived
+   */
+  void update(int roomId, const Transform &pose, long time);
+  void reset(long time);
+
+private:
+  mutable std::mutex _mutex;
+  int _roomId;
+  Transform _lastPose;
+  long _lastTime;
+  Transform _prevPose; // null if the last pose is the first in the room
+  long _prevTime;
+};
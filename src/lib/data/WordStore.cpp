@@ -0,0 +1,191 @@
+#include "lib/data/WordStore.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <tuple>
+
+namespace {
+const size_t ALIGNMENT = 64;
+} // namespace
+
+struct WordStore::Storage {
+  std::vector<uint64_t> wordEntryOffsets;
+  std::vector<int32_t> entryRoomIds;
+  std::vector<uint64_t> entryPointOffsets;
+  std::vector<cv::Point3f> points3;
+  std::shared_ptr<void> arena; // descriptors
+};
+
+WordStore::WordStore() {}
+
+WordStore::WordStore(const std::vector<int> &wordIds,
+                     const std::vector<int> &roomIds,
+                     const std::vector<cv::Point3f> &points3,
+                     const cv::Mat &descriptors,
+                     const cv::Mat &meanDescriptors, int numThreads) {
+  assert(wordIds.size() == roomIds.size());
+  assert(wordIds.size() == points3.size());
+  assert(wordIds.size() == static_cast<unsigned int>(descriptors.rows));
+
+  const size_t numPoints = wordIds.size();
+  int numWords = 0;
+  for (int wordId : wordIds) {
+    assert(wordId >= 0);
+    numWords = std::max(numWords, wordId + 1);
+  }
+
+  // order points by word, then by room, keeping their order otherwise
+  std::vector<int> order(numPoints);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return std::tie(wordIds[a], roomIds[a]) < std::tie(wordIds[b], roomIds[b]);
+  });
+
+  auto storage = std::make_shared<Storage>();
+  storage->wordEntryOffsets.reserve(numWords + 1);
+  storage->entryPointOffsets.emplace_back(0);
+  storage->points3.reserve(numPoints);
+  for (size_t i = 0; i < numPoints; i++) {
+    int p = order[i];
+    int wordId = wordIds[p];
+    if (i == 0 || wordId != wordIds[order[i - 1]] ||
+        roomIds[p] != roomIds[order[i - 1]]) {
+      if (i > 0) {
+        storage->entryPointOffsets.emplace_back(i);
+      }
+      while (storage->wordEntryOffsets.size() <=
+             static_cast<size_t>(wordId)) {
+        storage->wordEntryOffsets.emplace_back(storage->entryRoomIds.size());
+      }
+      storage->entryRoomIds.emplace_back(roomIds[p]);
+    }
+    storage->points3.emplace_back(points3[p]);
+  }
+  if (numPoints > 0) {
+    storage->entryPointOffsets.emplace_back(numPoints);
+  }
+  while (storage->wordEntryOffsets.size() <= static_cast<size_t>(numWords)) {
+    storage->wordEntryOffsets.emplace_back(storage->entryRoomIds.size());
+  }
+
+  // one aligned arena, so that each row starts on a cache line if the
+  // descriptor size is a multiple of it
+  const size_t rowSize = descriptors.cols * descriptors.elemSize();
+  void *arena = nullptr;
+  if (numPoints > 0 &&
+      posix_memalign(&arena, ALIGNMENT, numPoints * rowSize) != 0) {
+    throw std::bad_alloc();
+  }
+  storage->arena = std::shared_ptr<void>(arena, free);
+  if (numPoints > 0) {
+    _descriptors =
+        cv::Mat(numPoints, descriptors.cols, descriptors.type(), arena);
+  }
+
+  bool computeMeans = meanDescriptors.empty();
+  if (computeMeans) {
+    _meanDescriptors =
+        cv::Mat::zeros(numWords, descriptors.cols, descriptors.type());
+  } else {
+    assert(meanDescriptors.rows == numWords);
+    assert(meanDescriptors.type() == descriptors.type());
+    _meanDescriptors = meanDescriptors;
+  }
+
+  _wordEntryOffsets = Span<const uint64_t>(storage->wordEntryOffsets.data(),
+                                           storage->wordEntryOffsets.size());
+  _entryRoomIds = Span<const int32_t>(storage->entryRoomIds.data(),
+                                      storage->entryRoomIds.size());
+  _entryPointOffsets = Span<const uint64_t>(
+      storage->entryPointOffsets.data(), storage->entryPointOffsets.size());
+  _points3 = Span<const cv::Point3f>(storage->points3.data(),
+                                     storage->points3.size());
+  _storage = std::move(storage);
+
+  Utility::parallelFor(0, numWords, numThreads, [&](int w) {
+    size_t begin = _entryPointOffsets[_wordEntryOffsets[w]];
+    size_t end = _entryPointOffsets[_wordEntryOffsets[w + 1]];
+    for (size_t i = begin; i < end; i++) {
+      descriptors.row(order[i]).copyTo(_descriptors.row(i));
+    }
+    if (computeMeans && end > begin) {
+      cv::Mat mean = _meanDescriptors.row(w);
+      cv::reduce(_descriptors.rowRange(begin, end), mean, 0, CV_REDUCE_AVG);
+    }
+  });
+}
+
+WordStore::WordStore(Span<const uint64_t> wordEntryOffsets,
+                     Span<const int32_t> entryRoomIds,
+                     Span<const uint64_t> entryPointOffsets,
+                     Span<const cv::Point3f> points3,
+                     const cv::Mat &meanDescriptors,
+                     const cv::Mat &descriptors)
+    : _wordEntryOffsets(wordEntryOffsets), _entryRoomIds(entryRoomIds),
+      _entryPointOffsets(entryPointOffsets), _points3(points3),
+      _meanDescriptors(meanDescriptors), _descriptors(descriptors) {
+  assert(wordEntryOffsets.size() ==
+         static_cast<size_t>(meanDescriptors.rows) + 1);
+  assert(entryPointOffsets.size() == entryRoomIds.size() + 1);
+  assert(points3.size() == static_cast<size_t>(descriptors.rows));
+}
+
+int WordStore::getNumWords() const { return _meanDescriptors.rows; }
+
+size_t WordStore::getNumEntries() const { return _entryRoomIds.size(); }
+
+size_t WordStore::getNumPoints() const { return _points3.size(); }
+
+int WordStore::getDescType() const { return _meanDescriptors.type(); }
+
+int WordStore::getDescDim() const { return _meanDescriptors.cols; }
+
+const cv::Mat &WordStore::getMeanDescriptors() const {
+  return _meanDescriptors;
+}
+
+Span<const int32_t> WordStore::getRoomIds(int wordId) const {
+  assert(wordId >= 0 && wordId < getNumWords());
+  return _entryRoomIds.subspan(_wordEntryOffsets[wordId],
+                               _wordEntryOffsets[wordId + 1]);
+}
+
+long WordStore::findEntry(int wordId, int roomId) const {
+  assert(wordId >= 0 && wordId < getNumWords());
+  for (uint64_t e = _wordEntryOffsets[wordId];
+       e < _wordEntryOffsets[wordId + 1]; e++) {
+    if (_entryRoomIds[e] == roomId) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+Span<const cv::Point3f> WordStore::getEntryPoints3(size_t entry) const {
+  return _points3.subspan(_entryPointOffsets[entry],
+                          _entryPointOffsets[entry + 1]);
+}
+
+cv::Mat WordStore::getEntryDescriptors(size_t entry) const {
+  return _descriptors.rowRange(_entryPointOffsets[entry],
+                               _entryPointOffsets[entry + 1]);
+}
+
+Span<const uint64_t> WordStore::getWordEntryOffsets() const {
+  return _wordEntryOffsets;
+}
+
+Span<const int32_t> WordStore::getEntryRoomIds() const {
+  return _entryRoomIds;
+}
+
+Span<const uint64_t> WordStore::getEntryPointOffsets() const {
+  return _entryPointOffsets;
+}
+
+Span<const cv::Point3f> WordStore::getPoints3() const { return _points3; }
+
+const cv::Mat &WordStore::getDescriptors() const { return _descriptors; }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "lib/util/Span.h"
+#include <cstdint>
+#include <memory>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+/**
+ * All words in a flat structure-of-arrays layout. Word IDs are dense, from 0
+ * to getNumWords() - 1. The 3D points of a word are grouped by room into
+ * entries (compressed sparse rows):
+ *   word w has entries [wordEntryOffsets[w], wordEntryOffsets[w + 1])
+ *   entry e is in room entryRoomIds[e], and has points
+ *   [entryPointOffsets[e], entryPointOffsets[e + 1])
+ * Point i has its descriptor in row i of one 64-byte aligned arena, so the
+ * descriptors of an entry are a sub-matrix of it.
+ *
+ * Copies are shallow and share the arrays.
+ */
+class WordStore final {
+public:
+  explicit WordStore();
+
+  /*
+   * Group points by word and room. wordIds must be dense, and the means are
+   * computed if meanDescriptors is empty.
+   */
+  explicit WordStore(const std::vector<int> &wordIds,
+                     const std::vector<int> &roomIds,
+                     const std::vector<cv::Point3f> &points3,
+                     const cv::Mat &descriptors,
+                     const cv::Mat &meanDescriptors = cv::Mat(),
+                     int numThreads = 0);
+
+  /*
+   * A view of arrays owned by someone else, e.g. a memory-mapped artifact,
+   * which must outlive the store. Nothing is copied.
+   */
+  explicit WordStore(Span<const uint64_t> wordEntryOffsets,
+                     Span<const int32_t> entryRoomIds,
+                     Span<const uint64_t> entryPointOffsets,
+                     Span<const cv::Point3f> points3,
+                     const cv::Mat &meanDescriptors,
+                     const cv::Mat &descriptors);
+
+  int getNumWords() const;
+  size_t getNumEntries() const;
+  size_t getNumPoints() const;
+  int getDescType() const;
+  int getDescDim() const;
+
+  /*
+   * row w is the mean descriptor of word w
+   */
+  const cv::Mat &getMeanDescriptors() const;
+
+  /*
+   * the rooms of the entries of a word, entry wordEntryOffsets[w] first
+   */
+  Span<const int32_t> getRoomIds(int wordId) const;
+
+  /*
+   * return the entry of a word in a room, or -1 if the word is not in it
+   */
+  long findEntry(int wordId, int roomId) const;
+
+  Span<const cv::Point3f> getEntryPoints3(size_t entry) const;
+  cv::Mat getEntryDescriptors(size_t entry) const;
+
+  Span<const uint64_t> getWordEntryOffsets() const;
+  Span<const int32_t> getEntryRoomIds() const;
+  Span<const uint64_t> getEntryPointOffsets() const;
+  Span<const cv::Point3f> getPoints3() const;
+  const cv::Mat &getDescriptors() const;
+
+private:
+  struct Storage;
+
+  // null if the arrays are owned by someone else
+  std::shared_ptr<const Storage> _storage;
+  Span<const uint64_t> _wordEntryOffsets;
+  Span<const int32_t> _entryRoomIds;
+  Span<const uint64_t> _entryPointOffsets;
+  Span<const cv::Point3f> _points3;
+  cv::Mat _meanDescriptors;
+  cv::Mat _descriptors;
+};
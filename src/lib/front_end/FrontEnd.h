@@ -4,13 +4,17 @@
 #include "lib/data/FoundItem.h"
 #include "lib/data/Transform.h"
 #include "lib/data/Label.h"
+#include "lib/data/PoseStats.h"
+#include "lib/data/Session.h"
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <vector>
 
 // TODO: items are for test purpose only, remove remove in future releases
-typedef std::function<std::pair<int, Transform>(const cv::Mat &image, const CameraModel &camera, std::vector<FoundItem> *items)> LocalizeFunc;
-typedef std::function<std::map<int, std::vector<Label>>()> GetLabelsFunc;
+typedef std::function<std::pair<int, Transform>(const cv::Mat &image, const CameraModel &camera, std::vector<FoundItem> *items, PoseStats *stats, Session *session)> LocalizeFunc;
+typedef std::function<std::map<int, std::vector<Label>>(uint64_t &version)> GetLabelsFunc;
+typedef std::function<uint64_t()> GetLabelsVersionFunc;
 
 class FrontEnd {
 public:
@@ -34,12 +38,21 @@ public:
   }
   
   /**
-   * register a callback function for getLabels of all databases
+   * register a callback function for getLabels of all databases, which also
+   * sets the version of the labels it returns
    */
   void registerGetLabelsFunc(GetLabelsFunc getLabelsFunc) {
     _getLabelsFunc = getLabelsFunc;
   }
 
+  /**
+   * register a callback function for the version of the labels, which
+   * changes whenever the labels do
+   */
+  void registerGetLabelsVersionFunc(GetLabelsVersionFunc getLabelsVersionFunc) {
+    _getLabelsVersionFunc = getLabelsVersionFunc;
+  }
+
   /**
    * call the localize callback function
    */
@@ -54,7 +67,15 @@ public:
     return _getLabelsFunc;
   }
 
+  /**
+   * call the getLabelsVersion callback function
+   */
+  GetLabelsVersionFunc getLabelsVersionFunc() {
+    return _getLabelsVersionFunc;
+  }
+
 private:
   LocalizeFunc _localizeFunc;
   GetLabelsFunc _getLabelsFunc;
+  GetLabelsVersionFunc _getLabelsVersionFunc;
 };
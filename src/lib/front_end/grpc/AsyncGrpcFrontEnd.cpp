@@ -0,0 +1,340 @@
+#include "lib/front_end/grpc/AsyncGrpcFrontEnd.h"
+#include "lib/data/Session.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+/**
+ * The state of an RPC, used as the tag of its operations. Each call has at
+ * most one operation in flight, and proceed() runs when it completes.
+ */
+class AsyncGrpcFrontEnd::Call {
+public:
+  virtual ~Call() = default;
+
+  virtual void proceed(bool ok) = 0;
+};
+
+/**
+ * A localize stream: read a frame, localize it on a localize thread, write
+ * the response, and read the next one until the client is done.
+ */
+class AsyncGrpcFrontEnd::LocalizeCall final : public Call {
+public:
+  explicit LocalizeCall(AsyncGrpcFrontEnd &frontEnd, int queue)
+      : _frontEnd(frontEnd), _queue(queue), _stream(&_context),
+        _arenaBlock(ARENA_BLOCK_SIZE),
+        _arena(GrpcHandler::getArenaOptions(_arenaBlock)),
+        _response(nullptr), _state(CONNECT) {
+    grpc::ServerCompletionQueue *cq = _frontEnd._queues[_queue].get();
+    _frontEnd._service.Requestlocalize(&_context, &_stream, cq, cq, this);
+  }
+
+  ~LocalizeCall() {
+    if (_state != CONNECT) {
+      _frontEnd._queueCalls[_queue]--;
+    }
+  }
+
+  void proceed(bool ok) final {
+    if (_frontEnd._shutdown) {
+      delete this;
+      return;
+    }
+    switch (_state) {
+    case CONNECT:
+      if (!ok) {
+        delete this;
+        return;
+      }
+      new LocalizeCall(_frontEnd, _queue); // wait for the next stream
+      _frontEnd._queueCalls[_queue]++;
+      read();
+      break;
+    case READ:
+      if (ok) {
+        _state = QUEUED;
+        _frontEnd.admit(this);
+      } else {
+        finish(); // the client is done
+      }
+      break;
+    case WRITE:
+      if (ok) {
+        read();
+      } else {
+        finish();
+      }
+      break;
+    case QUEUED:
+      assert(false);
+      break;
+    case FINISH:
+      delete this;
+      break;
+    }
+  }
+
+  /**
+   * localize the frame that was read and write the response
+   */
+  void localize() {
+    newResponse();
+    _frontEnd._handler.localize(_request, *_response, _session);
+    write();
+  }
+
+  /**
+   * answer the frame that was read without a pose
+   */
+  void reject() {
+    newResponse();
+    _response->set_request_id(_request.request_id());
+    _response->set_success(false);
+    write();
+  }
+
+private:
+  enum State { CONNECT, READ, QUEUED, WRITE, FINISH };
+
+  void read() {
+    _state = READ;
+    _stream.Read(&_request, this);
+  }
+
+  // the last response has been written, so its memory can be reused
+  void newResponse() {
+    _arena.Reset();
+    _response = google::protobuf::Arena::CreateMessage<
+        snaplink_grpc::LocalizationResponse>(&_arena);
+  }
+
+  void write() {
+    _state = WRITE;
+    _stream.Write(*_response, this);
+  }
+
+  void finish() {
+    _state = FINISH;
+    _stream.Finish(grpc::Status::OK, this);
+  }
+
+private:
+  AsyncGrpcFrontEnd &_frontEnd;
+  int _queue;
+  grpc::ServerContext _context;
+  grpc::ServerAsyncReaderWriter<snaplink_grpc::LocalizationResponse,
+                                snaplink_grpc::LocalizationRequest>
+      _stream;
+  snaplink_grpc::LocalizationRequest _request; // reused with its buffers
+  std::vector<char> _arenaBlock;
+  google::protobuf::Arena _arena;
+  snaplink_grpc::LocalizationResponse *_response; // in _arena
+  // frames of a stream come from one client, so they share a tracking state
+  Session _session;
+  State _state;
+};
+
+/**
+ * A getLabels request. The response is cached, so it is answered on the
+ * polling thread, and sent without a copy.
+ */
+class AsyncGrpcFrontEnd::LabelsCall final : public Call {
+public:
+  explicit LabelsCall(AsyncGrpcFrontEnd &frontEnd, int queue)
+      : _frontEnd(frontEnd), _queue(queue), _responder(&_context),
+        _finished(false) {
+    grpc::ServerCompletionQueue *cq = _frontEnd._queues[_queue].get();
+    _frontEnd._service.RequestgetLabels(&_context, &_request, &_responder, cq,
+                                        cq, this);
+  }
+
+  ~LabelsCall() {
+    if (_finished) {
+      _frontEnd._queueCalls[_queue]--;
+    }
+  }
+
+  void proceed(bool ok) final {
+    if (_frontEnd._shutdown || !ok || _finished) {
+      delete this;
+      return;
+    }
+    new LabelsCall(_frontEnd, _queue); // wait for the next request
+    _frontEnd._queueCalls[_queue]++;
+    // Finish serializes the cached response, which is kept alive until the
+    // call is done
+    _response = _frontEnd._handler.getLabels(_request);
+    _finished = true;
+    _responder.Finish(*_response, grpc::Status::OK, this);
+  }
+
+private:
+  AsyncGrpcFrontEnd &_frontEnd;
+  int _queue;
+  grpc::ServerContext _context;
+  grpc::ServerAsyncResponseWriter<snaplink_grpc::GetLabelsResponse>
+      _responder;
+  snaplink_grpc::GetLabelsRequest _request;
+  std::shared_ptr<const snaplink_grpc::GetLabelsResponse> _response;
+  bool _finished;
+};
+
+AsyncGrpcFrontEnd::AsyncGrpcFrontEnd(int port, int grpcThreads,
+                                     int localizeThreads, int queueSize,
+                                     int queueTimeout, int decodeResolution)
+    : _serverAddress(std::to_string(port)),
+      _grpcThreads(std::max(grpcThreads, 1)),
+      _localizeThreads(localizeThreads), _queueTimeout(queueTimeout),
+      _handler(*this, decodeResolution),
+      _queueCalls(new std::atomic<int>[_grpcThreads]),
+      _jobs(std::max(queueSize, 1)), _shutdown(false), _numAdmitted(0),
+      _numParked(0), _numExpired(0) {
+  for (int i = 0; i < _grpcThreads; i++) {
+    _queueCalls[i] = 0;
+  }
+}
+
+AsyncGrpcFrontEnd::~AsyncGrpcFrontEnd() { stop(); }
+
+bool AsyncGrpcFrontEnd::start() {
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("0.0.0.0:" + _serverAddress,
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&_service);
+  for (int i = 0; i < _grpcThreads; i++) {
+    _queues.emplace_back(builder.AddCompletionQueue());
+  }
+  _server = builder.BuildAndStart();
+  if (_server == nullptr) {
+    return false;
+  }
+  std::cout << "Server listening on " << _serverAddress << " with "
+            << _grpcThreads << " completion queues" << std::endl;
+
+  for (int i = 0; i < _grpcThreads; i++) {
+    new LocalizeCall(*this, i);
+    new LabelsCall(*this, i);
+    _pollers.emplace_back(&AsyncGrpcFrontEnd::poll, this, i);
+  }
+  int numLocalizers = _localizeThreads;
+  if (numLocalizers <= 0) {
+    numLocalizers = std::max<int>(std::thread::hardware_concurrency(), 1);
+  }
+  for (int i = 0; i < numLocalizers; i++) {
+    _localizers.emplace_back(&AsyncGrpcFrontEnd::work, this);
+  }
+  return true;
+}
+
+void AsyncGrpcFrontEnd::stop() {
+  if (_server == nullptr) {
+    return;
+  }
+
+  // frames still waiting are answered before the server goes down
+  std::vector<Job> jobs = _jobs.close();
+  for (auto &thread : _localizers) {
+    thread.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(_parkedMutex);
+    jobs.insert(jobs.end(), _parked.begin(), _parked.end());
+    _parked.clear();
+  }
+  for (auto &job : jobs) {
+    job.call->reject();
+  }
+
+  // streams are open until their clients are done, so the calls left at the
+  // deadline are cancelled, and their operations complete with ok = false
+  _server->Shutdown(std::chrono::system_clock::now() +
+                    std::chrono::milliseconds(SHUTDOWN_TIMEOUT));
+  {
+    std::lock_guard<std::shared_timed_mutex> lock(_shutdownMutex);
+    _shutdown = true;
+    for (auto &queue : _queues) {
+      queue->Shutdown();
+    }
+  }
+  for (auto &thread : _pollers) {
+    thread.join();
+  }
+
+  _localizers.clear();
+  _pollers.clear();
+  _server.reset();
+  _queues.clear();
+}
+
+void AsyncGrpcFrontEnd::poll(int queue) {
+  void *tag;
+  bool ok;
+  while (_queues[queue]->Next(&tag, &ok)) {
+    std::shared_lock<std::shared_timed_mutex> lock(_shutdownMutex);
+    static_cast<Call *>(tag)->proceed(ok);
+  }
+}
+
+void AsyncGrpcFrontEnd::work() {
+  Job job;
+  while (_jobs.pop(job)) {
+    unpark();
+    long wait = Utility::getTime() - job.time;
+    if (wait > _queueTimeout) {
+      _numExpired++;
+      std::cout << "Frame waited " << wait << " ms, answering without a pose"
+                << std::endl;
+      job.call->reject();
+      continue;
+    }
+    printMetrics(wait);
+    job.call->localize();
+  }
+}
+
+void AsyncGrpcFrontEnd::admit(LocalizeCall *call) {
+  // frames are admitted in order, so parked ones go first
+  Job job = {call, static_cast<long>(Utility::getTime())};
+  {
+    std::lock_guard<std::mutex> lock(_parkedMutex);
+    // stop() drains the parked frames once, after closing the queue, so a
+    // frame read after that is answered here
+    if (!_jobs.isClosed()) {
+      if (_parked.empty() && _jobs.tryPush(job)) {
+        _numAdmitted++;
+        return;
+      }
+      // the stream is not read from until its frame is answered
+      _numParked++;
+      _parked.emplace_back(job);
+      std::cout << "Admission queue full, parking the stream" << std::endl;
+      return;
+    }
+  }
+  call->reject();
+}
+
+void AsyncGrpcFrontEnd::unpark() {
+  std::lock_guard<std::mutex> lock(_parkedMutex);
+  while (!_parked.empty() && _jobs.tryPush(_parked.front())) {
+    _numAdmitted++;
+    _parked.pop_front();
+  }
+}
+
+void AsyncGrpcFrontEnd::printMetrics(long wait) const {
+  std::cout << "Admission queue: waited " << wait << " ms, depth "
+            << _jobs.size() << " of " << _jobs.getCapacity() << ", peak "
+            << _jobs.getPeak() << ", " << _numAdmitted << " admitted, "
+            << _numParked << " parked, " << _numExpired << " expired"
+            << std::endl;
+  std::cout << "Connected calls per completion queue:";
+  for (int i = 0; i < _grpcThreads; i++) {
+    std::cout << " " << _queueCalls[i];
+  }
+  std::cout << std::endl;
+}
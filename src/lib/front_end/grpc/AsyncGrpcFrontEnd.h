@@ -0,0 +1,98 @@
+#pragma once
+
+#include "lib/front_end/FrontEnd.h"
+#include "lib/front_end/grpc/GrpcHandler.h"
+#include "lib/util/BoundedQueue.h"
+#include "GrpcService.grpc.pb.h"
+#include <atomic>
+#include <deque>
+#include <grpc++/grpc++.h>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// threads polling completion queues, one queue each
+#define GRPC_THREADS 1
+// threads localizing frames, 0 means one per core
+#define LOCALIZE_THREADS 0
+// frames waiting for a localize thread
+#define QUEUE_SIZE 32
+// milliseconds a frame may wait before it is answered without a pose
+#define QUEUE_TIMEOUT 1000
+// milliseconds open streams get to finish when the front end stops
+#define SHUTDOWN_TIMEOUT 1000
+
+/**
+ * A gRPC front end on the asynchronous API. Polling threads accept calls and
+ * move them along on completion queues, and never localize themselves.
+ * Frames read from localize streams wait in one bounded admission queue for
+ * the localize threads. When the queue is full, a stream is parked with its
+ * frame and not read from until a slot frees, which pushes back on the
+ * client through flow control. A frame that waited longer than the timeout
+ * is answered without a pose, so a burst of clients waits briefly instead of
+ * being turned away, and a stalled server sheds load.
+ */
+class AsyncGrpcFrontEnd final : public FrontEnd {
+public:
+  explicit AsyncGrpcFrontEnd(int port, int grpcThreads = GRPC_THREADS,
+                             int localizeThreads = LOCALIZE_THREADS,
+                             int queueSize = QUEUE_SIZE,
+                             int queueTimeout = QUEUE_TIMEOUT,
+                             int decodeResolution = 0);
+  ~AsyncGrpcFrontEnd();
+
+  bool start() final;
+  void stop() final;
+
+private:
+  class Call;
+  class LocalizeCall;
+  class LabelsCall;
+
+  struct Job {
+    LocalizeCall *call;
+    long time; // when it was queued
+  };
+
+  void poll(int queue);
+  void work();
+  void printMetrics(long wait) const;
+
+  /**
+   * queue the frame a stream has read, or park the stream if the queue is
+   * full
+   */
+  void admit(LocalizeCall *call);
+
+  // move parked frames into the queue while it has room
+  void unpark();
+
+private:
+  std::string _serverAddress;
+  int _grpcThreads;
+  int _localizeThreads;
+  long _queueTimeout;
+  GrpcHandler _handler;
+  snaplink_grpc::GrpcService::AsyncService _service;
+  std::unique_ptr<grpc::Server> _server;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> _queues;
+  // calls connected to a client per queue
+  std::unique_ptr<std::atomic<int>[]> _queueCalls;
+  BoundedQueue<Job> _jobs;
+  // frames that found the queue full, oldest first. Each stream has one
+  // frame in flight, so there are at most as many as streams.
+  std::mutex _parkedMutex;
+  std::deque<Job> _parked;
+  std::vector<std::thread> _pollers;
+  std::vector<std::thread> _localizers;
+  // held shared while starting operations, so that none start on a queue
+  // that is shut down
+  std::shared_timed_mutex _shutdownMutex;
+  bool _shutdown;
+  std::atomic<long> _numAdmitted;
+  std::atomic<long> _numParked; // the queue was full
+  std::atomic<long> _numExpired;  // waited longer than the timeout
+};
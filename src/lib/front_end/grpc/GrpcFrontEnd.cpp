@@ -1,12 +1,139 @@
 #include "lib/front_end/grpc/GrpcFrontEnd.h"
-#include "lib/data/CameraModel.h"
-#include <opencv2/core/core.hpp>
-#include <opencv2/opencv.hpp>
+#include "lib/data/Session.h"
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The frames of a localize stream in flight. The thread of the call reads
+ * frames while window workers localize them, so round trips overlap with
+ * computation. Responses are written as they finish, possibly out of order,
+ * and the client matches them by request_id. A frame still waiting for a
+ * worker when a newer one arrives is stale, and is answered at once without
+ * a pose.
+ */
+class GrpcFrontEnd::Stream final {
+public:
+  typedef grpc::ServerReaderWriter<snaplink_grpc::LocalizationResponse,
+                                   snaplink_grpc::LocalizationRequest>
+      ReaderWriter;
+
+  explicit Stream(GrpcHandler &handler, ReaderWriter *stream, int window)
+      : _handler(handler), _stream(stream), _window(std::max(window, 1)),
+        _done(false), _numFrames(0), _numStale(0) {}
+
+  /**
+   * serve the stream until the client is done and all frames are answered
+   */
+  void run() {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < _window; i++) {
+      workers.emplace_back(&Stream::work, this);
+    }
+
+    std::unique_ptr<snaplink_grpc::LocalizationRequest> request = newRequest();
+    snaplink_grpc::LocalizationResponse stale;
+    while (_stream->Read(request.get())) {
+      _numFrames++;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::swap(request, _pending);
+      }
+      _cond.notify_one();
+      if (request == nullptr) {
+        request = newRequest();
+        continue;
+      }
+      // reuse the stale request for the next frame
+      _numStale++;
+      stale.set_request_id(request->request_id());
+      stale.set_success(false);
+      write(stale);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _done = true;
+    }
+    _cond.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    std::cout << "Stream done: " << _numFrames << " frames, " << _numStale
+              << " stale" << std::endl;
+  }
+
+private:
+  // a request with buffers of an earlier frame, if there is one
+  std::unique_ptr<snaplink_grpc::LocalizationRequest> newRequest() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_free.empty()) {
+      return std::make_unique<snaplink_grpc::LocalizationRequest>();
+    }
+    std::unique_ptr<snaplink_grpc::LocalizationRequest> request =
+        std::move(_free.back());
+    _free.pop_back();
+    return request;
+  }
+
+  void work() {
+    // each response is built in an arena on the same block
+    std::vector<char> arenaBlock(ARENA_BLOCK_SIZE);
+    google::protobuf::Arena arena(GrpcHandler::getArenaOptions(arenaBlock));
+    while (true) {
+      std::unique_ptr<snaplink_grpc::LocalizationRequest> request;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _pending != nullptr || _done; });
+        if (_pending == nullptr) {
+          return;
+        }
+        request = std::move(_pending);
+      }
+
+      arena.Reset();
+      auto *response = google::protobuf::Arena::CreateMessage<
+          snaplink_grpc::LocalizationResponse>(&arena);
+      _handler.localize(*request, *response, _session);
+      write(*response);
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      _free.emplace_back(std::move(request));
+    }
+  }
+
+  // a stream may be read and written at the same time, but written by one
+  // thread at a time
+  void write(const snaplink_grpc::LocalizationResponse &response) {
+    std::lock_guard<std::mutex> lock(_writeMutex);
+    _stream->Write(response);
+  }
+
+private:
+  GrpcHandler &_handler;
+  ReaderWriter *_stream;
+  int _window;
+  // frames of a stream come from one client, so they share a tracking state
+  Session _session;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::unique_ptr<snaplink_grpc::LocalizationRequest> _pending; // newest
+  std::vector<std::unique_ptr<snaplink_grpc::LocalizationRequest>> _free;
+  bool _done; // the client is done
+  std::mutex _writeMutex;
+  long _numFrames;
+  long _numStale;
+};
 
 const std::string GrpcFrontEnd::none = "None";
 
-GrpcFrontEnd::GrpcFrontEnd(int grpcServerAddr, unsigned int maxClients) {
+GrpcFrontEnd::GrpcFrontEnd(int grpcServerAddr, unsigned int maxClients,
+                           int decodeResolution, int streamWindow)
+    : _streamWindow(streamWindow), _handler(*this, decodeResolution) {
   _numClients = 0;
   _serverAddress = std::to_string(grpcServerAddr);
   _maxClients = maxClients;
@@ -65,67 +192,7 @@ grpc::Status GrpcFrontEnd::localize(
     }
   }
 
-  snaplink_grpc::LocalizationRequest request;
-  while (stream->Read(&request)) {
-    snaplink_grpc::LocalizationResponse response;
-    response.set_request_id(request.request_id());
-    response.set_success(false);
-
-    std::vector<uchar> data(request.image().begin(), request.image().end());
-
-    bool copyData = false;
-    cv::Mat image = imdecode(cv::Mat(data, copyData), cv::IMREAD_GRAYSCALE);
-    if (image.empty() || image.type() != CV_8U || image.channels() != 1) {
-      stream->Write(response);
-      continue;
-    }
-
-    // TODO add orientation into JPEG, so we don't need to rotate ourselves
-    image = rotateImage(image, request.orientation());
-    imwrite("imageRotated.jpg", image);
-    int width = image.cols;
-    int height = image.rows;
-    response.set_width0(width);
-    response.set_height0(height);
-    float fx = request.camera().fx();
-    float fy = request.camera().fy();
-    float cx = request.camera().cx();
-    float cy = request.camera().cy();
-    updateIntrinsics(width, height, request.orientation(), cx, cy);
-    std::cout << "Width = " << width << ", Height = " << height
-              << " Cx = " << cx << " Cy = " << cy << std::endl;
-    CameraModel camera("", fx, fy, cx, cy, cv::Size(width, height));
-    std::vector<FoundItem> items;
-    std::pair<int, Transform>result = localizeFunc()(image, camera, &items);
-
-    int dbId = result.first;
-    Transform pose = result.second;
-    if (pose.isNull()) {
-      stream->Write(response);
-      continue;
-    }
-
-    response.set_db_id(dbId);
-    response.set_success(true);
-    response.mutable_pose()->set_cols(4);
-    response.mutable_pose()->set_rows(3);
-    for (unsigned int i = 0; i < 12; i++) {
-      response.mutable_pose()->add_data(pose.data()[i]);
-    }
-
-    // items are for test purpose only
-    for (unsigned int i = 0; i < items.size(); i++) {
-      snaplink_grpc::Item *item = response.add_items();
-      item->set_name(items[i].name());
-      item->set_x(items[i].x());
-      item->set_y(items[i].y());
-      item->set_size(items[i].size());
-    }
-    response.set_width(width > height ? height : width);
-    response.set_height(width > height ? width : height);
-
-    stream->Write(response);
-  }
+  Stream(_handler, stream, _streamWindow).run();
 
   {
     std::lock_guard<std::mutex> lock(_mutex);
@@ -137,58 +204,12 @@ grpc::Status GrpcFrontEnd::localize(
 
 grpc::Status
 GrpcFrontEnd::getLabels(grpc::ServerContext *context,
-                        const snaplink_grpc::Empty *empty,
+                        const snaplink_grpc::GetLabelsRequest *request,
                         snaplink_grpc::GetLabelsResponse *response) {
   (void)context; // avoid causing warnings
-  (void)empty; // avoid causing warnings
-
-  std::cout<<"getLabels triggered\n";
-  // TODO cache this
-  std::map<int, std::vector<Label>> labelsMap = getLabelsFunc()();
-  auto &map = *response->mutable_labels_map();
-  for (const auto &labels : labelsMap) {
-    int dbId = labels.first;
-    map[dbId] = snaplink_grpc::Labels();
-    for (const auto &label : labels.second) {
-      snaplink_grpc::Label *newLabel = map[dbId].add_labels();
-      newLabel->set_db_id(label.getDbId());
-      newLabel->set_x(label.getPoint3().x);
-      newLabel->set_y(label.getPoint3().y);
-      newLabel->set_z(label.getPoint3().z);
-      newLabel->set_name(label.getName());
-      std::cout<<"label name:" << label.getName() <<std::endl;
-    }
-  }
-  std::cout<<response->labels_map_size()<<" is the size of the map\n";
-  return grpc::Status::OK;
-}
 
-cv::Mat GrpcFrontEnd::rotateImage(cv::Mat img, int orientation) {
-  if (orientation == 8) { // 90
-    cv::transpose(img, img);
-    cv::flip(img, img, 1);
-  } else if (orientation == 3) { // 180
-    cv::flip(img, img, -1);
-  } else if (orientation == 6) { // 270
-    cv::transpose(img, img);
-    cv::flip(img, img, 0);
-  }
-  return img;
-}
-
-void GrpcFrontEnd::updateIntrinsics(int width, int height, int orientation,
-                                    float &cx, float &cy) {
-  float temp;
-  if (orientation == 8) { // 90
-    temp = cx;
-    cx = width - cy;
-    cy = temp;
-  } else if (orientation == 3) { // 180
-    cx = width - cx;
-    cy = height - cy;
-  } else if (orientation == 6) { // 270
-    temp = cx;
-    cx = cy;
-    cy = height - temp;
-  }
+  // the synchronous API serializes a message it owns, so this copies the
+  // cached response
+  *response = *_handler.getLabels(*request);
+  return grpc::Status::OK;
 }
@@ -3,17 +3,23 @@
 #include <QObject>
 #include <QThread>
 #include "lib/front_end/FrontEnd.h"
+#include "lib/front_end/grpc/GrpcHandler.h"
 #include <atomic>
 #include <mutex>  
 #include "GrpcService.grpc.pb.h"
 #include <grpc++/grpc++.h>
 
+// frames of a stream localized at once
+#define STREAM_WINDOW 1
+
 class FoundItem;
 class GrpcFrontEnd final : public QObject, public snaplink_grpc::GrpcService::Service, public FrontEnd {
   Q_OBJECT
 
 public:
-  explicit GrpcFrontEnd(int grpcServerAddr, unsigned int maxClients);
+  explicit GrpcFrontEnd(int grpcServerAddr, unsigned int maxClients,
+                        int decodeResolution = 0,
+                        int streamWindow = STREAM_WINDOW);
   ~GrpcFrontEnd();
 
   bool start() final;
@@ -23,20 +29,20 @@ public:
   
   grpc::Status getLabels(
     grpc::ServerContext *context,
-    const snaplink_grpc::Empty *empty,
-    snaplink_grpc::GetLabelsResponse *response); 
+    const snaplink_grpc::GetLabelsRequest *request,
+    snaplink_grpc::GetLabelsResponse *response);
 public slots:
   void run();
 
 private:
-  cv::Mat rotateImage(cv::Mat src, int orientation); // orinentation is EXIF orientation
-  void updateIntrinsics(int width, int height, int orientation, float &cx, float &cy);
+  class Stream;
 
-private:
   static const std::string none;
   QThread _thread;
   std::string _serverAddress;
   std::atomic<unsigned int> _numClients;
   std::atomic<unsigned int> _maxClients; 
+  int _streamWindow;
   std::mutex _mutex;
+  GrpcHandler _handler;
 };
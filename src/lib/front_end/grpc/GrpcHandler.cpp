@@ -0,0 +1,262 @@
+#include "lib/front_end/grpc/GrpcHandler.h"
+#include "lib/data/CameraModel.h"
+#include "lib/data/Session.h"
+#include "lib/front_end/FrontEnd.h"
+#include "lib/util/AllocationCounter.h"
+#include <algorithm>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <string>
+
+GrpcHandler::GrpcHandler(FrontEnd &frontEnd, int maxResolution)
+    : _frontEnd(frontEnd), _maxResolution(maxResolution) {}
+
+void GrpcHandler::localize(const snaplink_grpc::LocalizationRequest &request,
+                           snaplink_grpc::LocalizationResponse &response,
+                           Session &session) {
+  uint64_t threadAllocations = AllocationCounter::getThreadCount();
+  uint64_t allocations = AllocationCounter::getCount();
+  localizeImage(request, response, session);
+  std::cout << "Allocations: "
+            << AllocationCounter::getThreadCount() - threadAllocations
+            << " on the request thread, "
+            << AllocationCounter::getCount() - allocations
+            << " in the process" << std::endl;
+}
+
+void GrpcHandler::localizeImage(
+    const snaplink_grpc::LocalizationRequest &request,
+    snaplink_grpc::LocalizationResponse &response, Session &session) {
+  response.set_request_id(request.request_id());
+  response.set_success(false);
+
+  // decode straight from the bytes of the request, at the resolution the
+  // pipeline needs
+  const std::string &bytes = request.image();
+  if (bytes.empty()) {
+    return;
+  }
+  int fullWidth;
+  int fullHeight;
+  cv::Mat image = decodeImage(bytes, _maxResolution, fullWidth, fullHeight);
+  if (image.empty() || image.type() != CV_8U || image.channels() != 1) {
+    return;
+  }
+
+  // scale the intrinsics by the actual sizes, and keep pixel centers
+  double sx = static_cast<double>(image.cols) / fullWidth;
+  double sy = static_cast<double>(image.rows) / fullHeight;
+  float fx = request.camera().fx() * sx;
+  float fy = request.camera().fy() * sy;
+  float cx = (request.camera().cx() + 0.5) * sx - 0.5;
+  float cy = (request.camera().cy() + 0.5) * sy - 0.5;
+
+  // TODO add orientation into JPEG, so we don't need to rotate ourselves
+  int orientation = request.orientation();
+  image = rotateImage(image, orientation);
+  int width = image.cols;
+  int height = image.rows;
+  updateIntrinsics(width, height, orientation, cx, cy);
+  if (orientation == 6 || orientation == 8) {
+    std::swap(fullWidth, fullHeight);
+    std::swap(sx, sy);
+  }
+  // the client sees the image at full resolution
+  response.set_width0(fullWidth);
+  response.set_height0(fullHeight);
+  std::cout << "Width = " << width << ", Height = " << height
+            << " Cx = " << cx << " Cy = " << cy << ", decoded from "
+            << fullWidth << "x" << fullHeight << std::endl;
+  CameraModel camera("", fx, fy, cx, cy, cv::Size(width, height));
+  std::vector<FoundItem> items;
+  PoseStats stats;
+  std::pair<int, Transform> result = _frontEnd.localizeFunc()(
+      image, camera, &items, &stats, &session);
+
+  int dbId = result.first;
+  Transform pose = result.second;
+  if (pose.isNull()) {
+    return;
+  }
+
+  response.set_db_id(dbId);
+  response.set_success(true);
+  response.mutable_pose()->set_cols(4);
+  response.mutable_pose()->set_rows(3);
+  auto *poseData = response.mutable_pose()->mutable_data();
+  poseData->Resize(pose.size(), 0);
+  std::copy(pose.data(), pose.data() + pose.size(), poseData->mutable_data());
+  response.set_correspondences(stats.correspondences);
+  response.set_inliers(stats.inliers);
+  response.set_rms(stats.rms);
+  auto *covariance = response.mutable_covariance();
+  covariance->Reserve(stats.covariance.total());
+  for (auto iter = stats.covariance.begin<double>();
+       iter != stats.covariance.end<double>(); ++iter) {
+    covariance->AddAlreadyReserved(*iter);
+  }
+
+  // items are for test purpose only
+  response.mutable_items()->Reserve(items.size());
+  for (unsigned int i = 0; i < items.size(); i++) {
+    snaplink_grpc::Item *item = response.add_items();
+    item->set_name(items[i].name());
+    item->set_x((items[i].x() + 0.5) / sx - 0.5);
+    item->set_y((items[i].y() + 0.5) / sy - 0.5);
+    item->set_size(items[i].size() / sx);
+  }
+  response.set_width(std::min(fullWidth, fullHeight));
+  response.set_height(std::max(fullWidth, fullHeight));
+}
+
+google::protobuf::ArenaOptions
+GrpcHandler::getArenaOptions(std::vector<char> &block) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = block.data();
+  options.initial_block_size = block.size();
+  return options;
+}
+
+std::shared_ptr<const snaplink_grpc::GetLabelsResponse>
+GrpcHandler::getLabels(const snaplink_grpc::GetLabelsRequest &request) {
+  // clients that are up to date get an empty reply
+  uint64_t version = _frontEnd.getLabelsVersionFunc()();
+  if (request.version() == version) {
+    auto response = std::make_shared<snaplink_grpc::GetLabelsResponse>();
+    response->set_version(version);
+    std::cout << "getLabels: version " << version << " unchanged" << std::endl;
+    return response;
+  }
+
+  std::shared_ptr<const snaplink_grpc::GetLabelsResponse> response =
+      getLabelsResponse(version);
+  std::cout << "getLabels: version " << response->version() << ", "
+            << response->labels_map_size() << " rooms" << std::endl;
+  return response;
+}
+
+std::shared_ptr<const snaplink_grpc::GetLabelsResponse>
+GrpcHandler::getLabelsResponse(uint64_t version) {
+  // concurrent requests for a new version wait for one build
+  std::lock_guard<std::mutex> lock(_labelsMutex);
+  if (_labelsResponse != nullptr && _labelsResponse->version() >= version) {
+    return _labelsResponse;
+  }
+
+  // the labels are a snapshot taken together with their version, which is
+  // at least the one requested
+  uint64_t labelsVersion;
+  std::map<int, std::vector<Label>> labelsMap =
+      _frontEnd.getLabelsFunc()(labelsVersion);
+  auto response = std::make_shared<snaplink_grpc::GetLabelsResponse>();
+  response->set_version(labelsVersion);
+  auto &map = *response->mutable_labels_map();
+  for (const auto &labels : labelsMap) {
+    snaplink_grpc::Labels &roomLabels = map[labels.first];
+    for (const auto &label : labels.second) {
+      snaplink_grpc::Label *newLabel = roomLabels.add_labels();
+      newLabel->set_db_id(label.getDbId());
+      newLabel->set_x(label.getPoint3().x);
+      newLabel->set_y(label.getPoint3().y);
+      newLabel->set_z(label.getPoint3().z);
+      newLabel->set_name(label.getName());
+    }
+  }
+  _labelsResponse = response;
+  return _labelsResponse;
+}
+
+cv::Mat GrpcHandler::decodeImage(const std::string &bytes, int maxResolution,
+                                 int &width, int &height) {
+  cv::Mat buffer(1, bytes.size(), CV_8U, const_cast<char *>(bytes.data()));
+
+  // libjpeg scales in the IDCT, which is much cheaper than decoding at full
+  // resolution and resizing. The orientation comes with the request, so
+  // EXIF is ignored.
+  int flags = cv::IMREAD_GRAYSCALE;
+  if (maxResolution > 0 && readJpegSize(bytes, width, height)) {
+    int longSide = std::max(width, height);
+    if ((longSide + 7) / 8 >= maxResolution) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_8;
+    } else if ((longSide + 3) / 4 >= maxResolution) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_4;
+    } else if ((longSide + 1) / 2 >= maxResolution) {
+      flags = cv::IMREAD_REDUCED_GRAYSCALE_2;
+    }
+  }
+  cv::Mat image = cv::imdecode(buffer, flags | cv::IMREAD_IGNORE_ORIENTATION);
+  if (flags == cv::IMREAD_GRAYSCALE) {
+    width = image.cols;
+    height = image.rows;
+  }
+  return image;
+}
+
+bool GrpcHandler::readJpegSize(const std::string &bytes, int &width,
+                               int &height) {
+  const auto *data = reinterpret_cast<const unsigned char *>(bytes.data());
+  size_t size = bytes.size();
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    return false;
+  }
+
+  // walk the segments up to the start of frame
+  size_t i = 2;
+  while (i + 4 <= size) {
+    if (data[i] != 0xFF) {
+      return false;
+    }
+    unsigned char marker = data[i + 1];
+    if (marker == 0xFF) { // fill byte
+      i++;
+      continue;
+    }
+    if (marker == 0xD9 || marker == 0xDA) { // end of image, start of scan
+      return false;
+    }
+    // SOF0 to SOF15, except DHT, JPG and DAC
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      if (i + 9 > size) {
+        return false;
+      }
+      height = (data[i + 5] << 8) | data[i + 6];
+      width = (data[i + 7] << 8) | data[i + 8];
+      return width > 0 && height > 0;
+    }
+    i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+  }
+  return false;
+}
+
+cv::Mat GrpcHandler::rotateImage(const cv::Mat &img, int orientation) {
+  // one pass each, instead of a transpose and a flip
+  cv::Mat rotated;
+  if (orientation == 8) { // 90
+    cv::rotate(img, rotated, cv::ROTATE_90_CLOCKWISE);
+  } else if (orientation == 3) { // 180
+    cv::rotate(img, rotated, cv::ROTATE_180);
+  } else if (orientation == 6) { // 270
+    cv::rotate(img, rotated, cv::ROTATE_90_COUNTERCLOCKWISE);
+  } else {
+    rotated = img;
+  }
+  return rotated;
+}
+
+void GrpcHandler::updateIntrinsics(int width, int height, int orientation,
+                                   float &cx, float &cy) {
+  float temp;
+  if (orientation == 8) { // 90
+    temp = cx;
+    cx = width - cy;
+    cy = temp;
+  } else if (orientation == 3) { // 180
+    cx = width - cx;
+    cy = height - cy;
+  } else if (orientation == 6) { // 270
+    temp = cx;
+    cx = cy;
+    cy = height - temp;
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "GrpcService.grpc.pb.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+// bytes of the first arena block of a stream, which holds its responses
+#define ARENA_BLOCK_SIZE 16384
+
+class FrontEnd;
+class Session;
+
+/**
+ * Turns gRPC requests into calls of the front end callbacks and their
+ * results into responses, for both the synchronous and the asynchronous
+ * front ends. Methods may be called concurrently.
+ */
+class GrpcHandler final {
+public:
+  /**
+   * JPEGs are decoded at the smallest scale whose longer side is still at
+   * least maxResolution, and the whole pipeline, including AprilTag and QR
+   * detection, sees that image. 0 means full resolution.
+   */
+  explicit GrpcHandler(FrontEnd &frontEnd, int maxResolution = 0);
+
+  /**
+   * localize a frame of a stream, whose tracking state is session, and log
+   * the allocations it took. The response is best built in an arena that
+   * the stream reuses.
+   */
+  void localize(const snaplink_grpc::LocalizationRequest &request,
+                snaplink_grpc::LocalizationResponse &response,
+                Session &session);
+
+  /**
+   * options for an arena that starts on block, which a stream keeps, so that
+   * its responses cost no allocation once they fit in it
+   */
+  static google::protobuf::ArenaOptions
+  getArenaOptions(std::vector<char> &block);
+
+  /**
+   * all labels, or only the version if the client has the current one. The
+   * response with all labels is shared by the requests of its version, so
+   * it is sent as is and never copied.
+   */
+  std::shared_ptr<const snaplink_grpc::GetLabelsResponse>
+  getLabels(const snaplink_grpc::GetLabelsRequest &request);
+
+private:
+  void localizeImage(const snaplink_grpc::LocalizationRequest &request,
+                     snaplink_grpc::LocalizationResponse &response,
+                     Session &session);
+
+  // the response with all labels of a version, built once per version
+  std::shared_ptr<const snaplink_grpc::GetLabelsResponse>
+  getLabelsResponse(uint64_t version);
+
+  /**
+   * decode a grayscale image, scaled down by 2, 4 or 8 in the DCT domain if
+   * it is a JPEG whose longer side stays at least maxResolution. width and
+   * height are the size at full resolution.
+   */
+  static cv::Mat decodeImage(const std::string &bytes, int maxResolution,
+                             int &width, int &height);
+
+  // read the size from the frame header of a JPEG
+  static bool readJpegSize(const std::string &bytes, int &width, int &height);
+
+  // orinentation is EXIF orientation
+  static cv::Mat rotateImage(const cv::Mat &src, int orientation);
+  static void updateIntrinsics(int width, int height, int orientation,
+                               float &cx, float &cy);
+
+private:
+  FrontEnd &_frontEnd;
+  int _maxResolution;
+  std::mutex _labelsMutex;
+  std::shared_ptr<const snaplink_grpc::GetLabelsResponse> _labelsResponse;
+};
@@ -0,0 +1,55 @@
+#include "lib/util/AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<uint64_t> count(0);
+thread_local uint64_t threadCount = 0;
+
+void *allocate(std::size_t size) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  threadCount++;
+  return std::malloc(size == 0 ? 1 : size);
+}
+} // namespace
+
+uint64_t AllocationCounter::getCount() {
+  return count.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::getThreadCount() { return threadCount; }
+
+void *operator new(std::size_t size) {
+  void *p = allocate(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
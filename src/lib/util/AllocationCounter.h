@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Counts heap allocations made through the global operator new, which this
+ * library replaces. Counting is one relaxed increment per allocation, for
+ * the process and for the calling thread.
+ */
+class AllocationCounter final {
+public:
+  /* allocations by all threads so far */
+  static uint64_t getCount();
+
+  /* allocations by the calling thread so far */
+  static uint64_t getThreadCount();
+};
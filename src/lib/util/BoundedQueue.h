@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+/**
+ * A FIFO of at most capacity items between threads. Producers never wait,
+ * so that a full queue pushes back on them, and consumers wait for items
+ * until the queue is closed.
+ */
+template <class T> class BoundedQueue final {
+public:
+  explicit BoundedQueue(size_t capacity)
+      : _capacity(capacity), _peak(0), _closed(false) {}
+
+  /**
+   * return false if the queue is full or closed
+   */
+  bool tryPush(T item) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_closed || _items.size() >= _capacity) {
+        return false;
+      }
+      _items.emplace_back(std::move(item));
+      _peak = std::max(_peak, _items.size());
+    }
+    _cond.notify_one();
+    return true;
+  }
+
+  /**
+   * wait for the oldest item, return false once the queue is closed
+   */
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return _closed || !_items.empty(); });
+    if (_closed) {
+      return false;
+    }
+    item = std::move(_items.front());
+    _items.pop_front();
+    return true;
+  }
+
+  /**
+   * wait at most timeout ms for the oldest item, return false if there was
+   * none or the queue is closed
+   */
+  bool pop(T &item, long timeout) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait_for(lock, std::chrono::milliseconds(timeout),
+                   [this] { return _closed || !_items.empty(); });
+    if (_closed || _items.empty()) {
+      return false;
+    }
+    item = std::move(_items.front());
+    _items.pop_front();
+    return true;
+  }
+
+  bool isClosed() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _closed;
+  }
+
+  /**
+   * wake up all consumers, and return the items that were left
+   */
+  std::vector<T> close() {
+    std::vector<T> items;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+      items.assign(std::make_move_iterator(_items.begin()),
+                   std::make_move_iterator(_items.end()));
+      _items.clear();
+    }
+    _cond.notify_all();
+    return items;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _items.size();
+  }
+
+  size_t getCapacity() const { return _capacity; }
+
+  /**
+   * the most items the queue has held at once
+   */
+  size_t getPeak() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _peak;
+  }
+
+private:
+  const size_t _capacity;
+  size_t _peak;
+  bool _closed;
+  std::deque<T> _items;
+  mutable std::mutex _mutex;
+  std::condition_variable _cond;
+};
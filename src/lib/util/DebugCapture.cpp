@@ -0,0 +1,107 @@
+#include "lib/util/DebugCapture.h"
+#include "lib/util/Utility.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+
+namespace {
+// how often the writer checks for a dump request while idle
+const long DUMP_POLL_TIME = 200;
+} // namespace
+
+DebugCapture::DebugCapture(const std::string &dir, double rate, int ringSize,
+                           int queueSize)
+    : _dir(dir), _rate(rate), _ringNext(0), _numCaptured(0),
+      _queue(std::max(queueSize, 1)), _dumpRequested(false), _numDropped(0) {
+  _ring.reserve(std::max(ringSize, 1));
+  mkdir(_dir.c_str(), 0755);
+  _writer = std::thread(&DebugCapture::write, this);
+}
+
+DebugCapture::~DebugCapture() {
+  _queue.close();
+  _writer.join();
+}
+
+void DebugCapture::capture(const cv::Mat &image, int roomId,
+                           const Transform &pose) {
+  Entry entry{Utility::getTime(), 0, image, roomId, pose};
+  bool sampled;
+  {
+    std::lock_guard<std::mutex> lock(_ringMutex);
+    entry.id = _numCaptured;
+    if (_ring.size() < _ring.capacity()) {
+      _ring.emplace_back(entry);
+    } else {
+      _ring[_ringNext] = entry;
+      _ringNext = (_ringNext + 1) % _ring.size();
+    }
+    // every 1 / rate-th query, evenly spaced
+    _numCaptured++;
+    sampled = std::floor(_numCaptured * _rate) >
+              std::floor((_numCaptured - 1) * _rate);
+  }
+
+  if (sampled && !_queue.tryPush(std::move(entry))) {
+    _numDropped++;
+    std::cout << "Capture dropped, " << _numDropped << " so far" << std::endl;
+  }
+}
+
+void DebugCapture::dump() { _dumpRequested = true; }
+
+void DebugCapture::write() {
+  Entry entry;
+  while (!_queue.isClosed()) {
+    if (_queue.pop(entry, DUMP_POLL_TIME)) {
+      writeEntry(_dir, entry);
+    }
+    if (_dumpRequested.exchange(false)) {
+      writeDump();
+    }
+  }
+}
+
+void DebugCapture::writeDump() {
+  std::vector<Entry> entries;
+  {
+    std::lock_guard<std::mutex> lock(_ringMutex);
+    // oldest first
+    for (size_t i = 0; i < _ring.size(); i++) {
+      entries.emplace_back(_ring[(_ringNext + i) % _ring.size()]);
+    }
+  }
+
+  std::string dir = _dir + "/dump-" + std::to_string(Utility::getTime());
+  mkdir(dir.c_str(), 0755);
+  int numWritten = 0;
+  for (const auto &entry : entries) {
+    numWritten += writeEntry(dir, entry);
+  }
+  std::cout << "Dumped " << numWritten << " captures to " << dir << std::endl;
+}
+
+bool DebugCapture::writeEntry(const std::string &dir, const Entry &entry) {
+  std::string name =
+      std::to_string(entry.time) + "-" + std::to_string(entry.id);
+  if (!cv::imwrite(dir + "/" + name + ".jpg", entry.image)) {
+    std::cerr << "writing capture " << name << " to " << dir << " failed"
+              << std::endl;
+    return false;
+  }
+
+  std::ofstream out(dir + "/captures.txt", std::ios::app);
+  out << name << " " << entry.roomId;
+  if (entry.pose.isNull()) {
+    out << " none";
+  } else {
+    for (int i = 0; i < entry.pose.size(); i++) {
+      out << " " << entry.pose.data()[i];
+    }
+  }
+  out << std::endl;
+  return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "lib/data/Transform.h"
+#include "lib/util/BoundedQueue.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+// recent queries kept in memory for a dump
+#define CAPTURE_RING_SIZE 16
+// sampled queries waiting for the writer, beyond which they are dropped
+#define CAPTURE_QUEUE_SIZE 8
+// the fraction of queries written to disk as they come
+#define CAPTURE_RATE 0.0
+
+/**
+ * Keeps the most recent query images and their results in a bounded ring,
+ * and writes a sample of them to a directory from a background thread.
+ * capture() never waits on the disk: a sampled query that finds the writer
+ * behind is dropped. dump() asks the writer to write the whole ring, and
+ * only sets a flag, so that it may be called from a signal handler.
+ *
+ * Query n at time t is written as t-n.jpg, with a line "t-n <room ID>
+ * <pose>" appended to captures.txt, where the pose is 12 numbers or "none".
+ * A dump goes to a directory dump-<time> in the same format.
+ */
+class DebugCapture final {
+public:
+  explicit DebugCapture(const std::string &dir, double rate = CAPTURE_RATE,
+                        int ringSize = CAPTURE_RING_SIZE,
+                        int queueSize = CAPTURE_QUEUE_SIZE);
+  ~DebugCapture();
+
+  /**
+   * image is shared, not copied, so it must not be modified afterwards
+   */
+  void capture(const cv::Mat &image, int roomId, const Transform &pose);
+
+  void dump();
+
+private:
+  struct Entry {
+    uint64_t time;
+    uint64_t id;
+    cv::Mat image;
+    int roomId;
+    Transform pose;
+  };
+
+  void write();
+  void writeDump();
+  static bool writeEntry(const std::string &dir, const Entry &entry);
+
+private:
+  std::string _dir;
+  double _rate;
+  std::mutex _ringMutex;
+  std::vector<Entry> _ring;
+  size_t _ringNext; // the oldest entry once the ring is full
+  uint64_t _numCaptured;
+  BoundedQueue<Entry> _queue;
+  std::atomic<bool> _dumpRequested;
+  std::atomic<uint64_t> _numDropped;
+  std::thread _writer;
+};
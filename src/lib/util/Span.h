@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+/**
+ * A non-owning view of size contiguous elements of T
+ */
+template <class T> class Span final {
+public:
+  Span() : _data(nullptr), _size(0) {}
+
+  Span(T *data, size_t size) : _data(data), _size(size) {}
+
+  T *data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  T *begin() const { return _data; }
+  T *end() const { return _data + _size; }
+
+  T &operator[](size_t i) const {
+    assert(i < _size);
+    return _data[i];
+  }
+
+  /**
+   * return the view of elements [begin, end)
+   */
+  Span<T> subspan(size_t begin, size_t end) const {
+    assert(begin <= end && end <= _size);
+    return Span<T>(_data + begin, end - begin);
+  }
+
+private:
+  T *_data;
+  size_t _size;
+};
@@ -1,13 +1,17 @@
 #include "lib/util/Utility.h"
+#include "lib/data/CameraModel.h"
 #include "lib/data/FoundItem.h"
 #include "lib/data/Image.h"
 #include "lib/data/Transform.h"
+#include <algorithm>
+#include <atomic>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <pcl/common/transforms.h>
 #include <rtabmap/core/util3d.h>
 #include <stddef.h>
 #include <sys/time.h>
+#include <thread>
 #include <zbar.h>
 unsigned long long Utility::getTime() {
   struct timeval tv;
@@ -35,6 +39,51 @@ void Utility::showProgress(float progress) {
   std::cout.flush();
 }
 
+void Utility::parallelFor(int begin, int end, int numThreads,
+                          const std::function<void(int)> &func) {
+  if (numThreads <= 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  numThreads = std::max(1, std::min(numThreads, end - begin));
+
+  std::atomic<int> next(begin);
+  auto worker = [&]() {
+    for (int i = next++; i < end; i = next++) {
+      func(i);
+    }
+  };
+
+  // the calling thread is one of the workers
+  std::vector<std::thread> threads;
+  for (int i = 1; i < numThreads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool Utility::downsample(const cv::Mat &image, const CameraModel &camera,
+                         int maxResolution, cv::Mat &outImage,
+                         CameraModel &outCamera) {
+  int longSide = std::max(image.cols, image.rows);
+  if (maxResolution <= 0 || longSide <= maxResolution) {
+    return false;
+  }
+
+  double scale = static_cast<double>(maxResolution) / longSide;
+  cv::resize(image, outImage, cv::Size(), scale, scale, cv::INTER_AREA);
+
+  // scale by the actual sizes, which are rounded, and keep pixel centers
+  double sx = static_cast<double>(outImage.cols) / image.cols;
+  double sy = static_cast<double>(outImage.rows) / image.rows;
+  outCamera = CameraModel(camera.name(), camera.fx() * sx, camera.fy() * sy,
+                          (camera.cx() + 0.5) * sx - 0.5,
+                          (camera.cy() + 0.5) * sy - 0.5, outImage.size());
+  return true;
+}
+
 bool Utility::getPoint3World(const Image &image, const cv::Point2f &point2,
                              cv::Point3f &point3) {
   Transform pose = image.getPose();
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <functional>
 #include <list>
 #include <map>
 #include <opencv2/core/core.hpp>
 #include <pcl/common/common.h>
 #include <vector>
 
+class CameraModel;
 class Image;
 class Transform;
 
@@ -17,6 +19,18 @@ public:
   /* show a progress bar, input is [0, 1]*/
   static void showProgress(float progress);
 
+  /* call func(i) for i in [begin, end) on numThreads threads, 0 means one
+   * thread per core */
+  static void parallelFor(int begin, int end, int numThreads,
+                          const std::function<void(int)> &func);
+
+  /* downsample an image so that its longer side is at most maxResolution
+   * pixels, and scale the intrinsics of its camera to match. Return false
+   * and leave the outputs alone if it is small enough or maxResolution is 0 */
+  static bool downsample(const cv::Mat &image, const CameraModel &camera,
+                         int maxResolution, cv::Mat &outImage,
+                         CameraModel &outCamera);
+
   static bool getPoint3World(const Image &image, const cv::Point2f &point2,
                              cv::Point3f &point3);
 
@@ -1,3 +1,5 @@
+#include "bench/Bench.h"
+#include "build/Build.h"
 #include "label/Labeler.h"
 #include "measure/Measure.h"
 #include "run/Run.h"
@@ -17,6 +19,12 @@ int main(int argc, char *argv[]) {
     if (std::string(argv[1]) == "run") {
       Run run;
       return run.run(argc - 1, argv + 1);
+    } else if (std::string(argv[1]) == "build") {
+      Build build;
+      return build.run(argc - 1, argv + 1);
+    } else if (std::string(argv[1]) == "bench") {
+      Bench bench;
+      return bench.run(argc - 1, argv + 1);
     } else if (std::string(argv[1]) == "vis") {
       Visualizer visualizer;
       return visualizer.run(argc - 1, argv + 1);
@@ -81,6 +89,8 @@ static void printUsage(const po::options_description &desc) {
             << desc << std::endl
             << "commands:" << std::endl
             << "  run        run snaplink" << std::endl
+            << "  build      build an artifact from databases" << std::endl
+            << "  bench      benchmark word indexes" << std::endl
             << "  vis        visualize a datobase" << std::endl
             << "  label      label a database" << std::endl;
 }
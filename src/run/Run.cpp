@@ -1,16 +1,32 @@
 #include "run/Run.h"
 #include "lib/data/FoundItem.h"
 #include "lib/data/Label.h"
+#include "lib/data/Session.h"
 #include "lib/data/Transform.h"
+#include "lib/front_end/grpc/AsyncGrpcFrontEnd.h"
 #include "lib/front_end/grpc/GrpcFrontEnd.h"
+#include "lib/util/DebugCapture.h"
 #include "lib/util/Utility.h"
 #include "lib/visualize/visualize.h"
 #include <QCoreApplication>
 #include <QtConcurrent>
+#include <atomic>
+#include <csignal>
 #include <cstdio>
 #include <pthread.h>
 #include <utility>
 
+namespace {
+// the capture that SIGUSR1 dumps
+DebugCapture *debugCapture = nullptr;
+
+void onDumpSignal(int) {
+  if (debugCapture != nullptr) {
+    debugCapture->dump();
+  }
+}
+} // namespace
+
 int Run::run(int argc, char *argv[]) {
   // Parse arguments
   po::options_description visible("command options");
@@ -18,18 +34,120 @@ int Run::run(int argc, char *argv[]) {
       ("help,h", "print help message") //
       ("port,p", po::value<int>(&_port)->default_value(8080),
        "the port that GRPC front end binds to") //
+      ("front-end",
+       po::value<std::string>(&_frontEndType)->default_value(FRONT_END),
+       "sync, which turns away streams beyond --max-clients, or async, which "
+       "queues frames from any number of streams") //
+      ("max-clients",
+       po::value<int>(&_maxClients)->default_value(MAX_CLIENTS),
+       "streams served at once by the sync front end") //
+      ("stream-window",
+       po::value<int>(&_streamWindow)->default_value(STREAM_WINDOW),
+       "frames of a stream localized at once by the sync front end. A frame "
+       "waiting for them is answered without a pose when a newer one "
+       "arrives") //
+      ("grpc-threads",
+       po::value<int>(&_grpcThreads)->default_value(GRPC_THREADS),
+       "threads polling completion queues in the async front end") //
+      ("localize-threads",
+       po::value<int>(&_localizeThreads)->default_value(LOCALIZE_THREADS),
+       "threads localizing queued frames in the async front end, 0 means one "
+       "per core") //
+      ("queue-size", po::value<int>(&_queueSize)->default_value(QUEUE_SIZE),
+       "frames the async front end queues before it stops reading from "
+       "streams until a frame is done") //
+      ("queue-timeout",
+       po::value<int>(&_queueTimeout)->default_value(QUEUE_TIMEOUT),
+       "ms a queued frame may wait in the async front end before it is "
+       "answered without a pose") //
       ("feature-limit,f", po::value<int>(&_featureLimit)->default_value(0),
-       "limit the number of features used") //
+       "limit the number of features used, keeping the strongest spread "
+       "over the image") //
+      ("feature-threads",
+       po::value<int>(&_featureThreads)->default_value(FEATURE_THREADS),
+       "extract the features of an image in tiles on n threads, which lowers "
+       "latency when there are fewer requests than cores") //
+      ("max-resolution",
+       po::value<int>(&_maxResolution)->default_value(MAX_RESOLUTION),
+       "downsample query images to at most n pixels on the longer side "
+       "before localizing them, 0 means full resolution") //
+      ("reduced-decode",
+       po::bool_switch(&_reducedDecode)->default_value(false),
+       "with --max-resolution, decode JPEGs at 1/2, 1/4 or 1/8 scale when "
+       "that is still larger, which is faster. AprilTags and QR codes are "
+       "then detected in the smaller image, with less range and precision") //
       ("visualize,v", po::value<int>(&_visCount)->default_value(0),
        "Show localized camera pose in 3D model up to n latest poses") //
       ("corr-limit,c", po::value<int>(&_corrLimit)->default_value(0),
        "limit the number of corresponding 2D-3D points used") //
+      ("pnp", po::value<std::string>(&_pnpType)->default_value(PNP_TYPE),
+       "pose estimation: ransac (OpenCV) or prosac (ordered by match "
+       "quality, with local optimization)") //
+      ("min-inliers",
+       po::value<int>(&_minInliers)->default_value(MIN_INLIERS),
+       "drop image localization poses with fewer PnP inliers") //
+      ("top-rooms", po::value<int>(&_topRooms)->default_value(TOP_ROOMS),
+       "run PnP for the n best rooms of room search concurrently") //
+      ("accept-inliers",
+       po::value<int>(&_acceptInliers)->default_value(ACCEPT_INLIERS),
+       "with --top-rooms, accept the first pose with this many inliers and "
+       "stop verifying the other rooms") //
+      ("session-timeout",
+       po::value<int>(&_sessionTimeout)->default_value(SESSION_TIMEOUT),
+       "ms for which a stream is tracked in its last room from its last "
+       "pose, 0 localizes every frame globally") //
+      ("track-inliers",
+       po::value<int>(&_trackInliers)->default_value(TRACK_INLIERS),
+       "search all rooms again when a tracked pose has fewer inliers") //
+      ("occlusion-voxel",
+       po::value<float>(&_occlusionVoxel)->default_value(OCCUPANCY_VOXEL_SIZE),
+       "voxel size in meters of the occupancy grids built from room depth "
+       "images to drop occluded labels, 0 keeps occluded labels") //
+      ("max-items", po::value<int>(&_maxItems)->default_value(MAX_ITEMS),
+       "return at most n labels, nearest to the image center first, 0 means "
+       "all visible labels") //
+      ("capture-dir", po::value<std::string>(&_captureDir),
+       "keep the latest query images in memory, write samples of them to "
+       "this directory, and all of them on SIGUSR1") //
+      ("capture-rate",
+       po::value<double>(&_captureRate)->default_value(CAPTURE_RATE),
+       "the fraction of query images written to --capture-dir") //
+      ("capture-ring",
+       po::value<int>(&_captureRing)->default_value(CAPTURE_RING_SIZE),
+       "query images kept in memory for SIGUSR1") //
       ("save-image,s", po::bool_switch(&_saveImage)->default_value(false),
-       "save images to files, which can causes significant delays.") //
+       "write all query images, to --capture-dir or the current directory. "
+       "Images are dropped if the disk falls behind.") //
       ("tag-size, z", po::value<double>(&_tagSize)->default_value(0.16),
        "size of april-tags used in the room") //
       ("dist-ratio,d", po::value<float>(&_distRatio)->default_value(0.7),
-       "distance ratio used to create words");
+       "distance ratio used to create words") //
+      ("cluster-batch", po::value<int>(&_clusterBatchSize)->default_value(0),
+       "cluster words approximately in parallel, n descriptors at a time, "
+       "0 means exact clustering") //
+      ("cluster-checks", po::value<int>(&_clusterChecks)->default_value(32),
+       "KD-tree leaves checked per descriptor in approximate clustering") //
+      ("load-threads", po::value<int>(&_loadThreads)->default_value(0),
+       "threads used to read databases and create words, 0 means one per "
+       "core") //
+      ("ann", po::value<std::string>(&_annParams.type)->default_value(ANN_TYPE),
+       "word index: flann (KD-trees), hnsw (graph) or brute (exact)") //
+      ("ann-trees",
+       po::value<int>(&_annParams.flannTrees)->default_value(FLANN_TREES),
+       "KD-trees in a flann word index") //
+      ("ann-checks",
+       po::value<int>(&_annParams.flannChecks)->default_value(FLANN_CHECKS),
+       "leaves checked per descriptor in a flann word index") //
+      ("hnsw-m", po::value<int>(&_annParams.hnswM)->default_value(HNSW_M),
+       "links per node in an hnsw word index") //
+      ("hnsw-ef-construction",
+       po::value<int>(&_annParams.hnswEfConstruction)
+           ->default_value(HNSW_EF_CONSTRUCTION),
+       "candidates kept while building an hnsw word index") //
+      ("hnsw-ef", po::value<int>(&_annParams.hnswEf)->default_value(HNSW_EF),
+       "candidates kept per descriptor in an hnsw word index") //
+      ("artifact,a", po::value<std::string>(&_artifactPath),
+       "artifact created by snaplink build, rebuilt if databases changed");
 
   po::options_description hidden;
   hidden.add_options() // use comment to force new line using formater
@@ -71,19 +189,30 @@ int Run::run(int argc, char *argv[]) {
 
   // Run the program
   QCoreApplication app(argc, argv);
-  std::map<int, Word> words;
+  WordStore words;
   std::map<int, Room> rooms;
   std::map<int, std::vector<Label>> labels;
   std::cout << "READING DATABASES" << std::endl;
-  _adapter = std::make_unique<RTABMapAdapter>(_distRatio);
+  _adapter = std::make_unique<RTABMapAdapter>(_distRatio, _clusterBatchSize,
+                                              _clusterChecks, _loadThreads);
   if (!_adapter->init(
           std::set<std::string>(_dbFiles.begin(), _dbFiles.end()))) {
     std::cerr << "reading data failed";
     return 1;
   }
 
-  words = _adapter->getWords();
-  rooms = _adapter->getRooms();
+  // words and rooms are read from the artifact if it matches the databases
+  bool artifactLoaded = false;
+  if (!_artifactPath.empty()) {
+    _artifact = std::make_unique<Artifact>(
+        _artifactPath, std::set<std::string>(_dbFiles.begin(), _dbFiles.end()),
+        _distRatio, _clusterBatchSize, _clusterChecks);
+    artifactLoaded = _artifact->load(words, rooms);
+  }
+  if (!artifactLoaded) {
+    words = _adapter->getWords();
+    rooms = _adapter->getRooms();
+  }
   labels = _adapter->getLabels();
 
   if (_visCount > 0) {
@@ -91,27 +220,67 @@ int Run::run(int argc, char *argv[]) {
     QtConcurrent::run(_visualize.get(), &Visualize::startVis);
   }
 
+  if (_saveImage) {
+    _captureRate = 1;
+    if (_captureDir.empty()) {
+      _captureDir = ".";
+    }
+  }
+  if (!_captureDir.empty()) {
+    _debugCapture = std::make_unique<DebugCapture>(_captureDir, _captureRate,
+                                                   _captureRing);
+    debugCapture = _debugCapture.get();
+    std::signal(SIGUSR1, onDumpSignal);
+  }
+
   std::cout << "RUNNING COMPUTING ELEMENTS" << std::endl;
-  _feature = std::make_unique<Feature>(_featureLimit);
-  _wordSearch = std::make_unique<WordSearch>(words);
+  _feature = std::make_unique<Feature>(_featureLimit, _featureThreads);
+  _annParams.numThreads = _loadThreads;
+  std::string indexPath;
+  if (artifactLoaded && _artifact->hasIndex(_annParams.type)) {
+    indexPath = _artifact->getIndexPath(_annParams.type);
+  }
+  _wordSearch = std::make_unique<WordSearch>(words, _annParams, indexPath);
+  if (!artifactLoaded && _artifact != nullptr) {
+    std::cout << "REBUILDING ARTIFACT" << std::endl;
+    _artifact->save(words, rooms, *_wordSearch);
+  } else if (artifactLoaded && !_wordSearch->isIndexLoaded()) {
+    _artifact->saveIndex(*_wordSearch);
+  }
   _roomSearch = std::make_unique<RoomSearch>(rooms, words);
-  _perspective =
-      std::make_unique<Perspective>(rooms, words, _corrLimit, _distRatio);
-  _visibility = std::make_unique<Visibility>(labels);
+  _perspective = std::make_unique<Perspective>(
+      rooms, words, _corrLimit, _distRatio, _pnpType, INDEX_MIN_POINTS,
+      _loadThreads);
+  _visibility = std::make_unique<Visibility>(
+      labels, &_adapter->getImages(), _occlusionVoxel, _maxItems, _loadThreads);
   _aprilTag = std::make_unique<Apriltag>(_tagSize);
   _QR = std::make_unique<QR>();
 
   std::cerr << "initializing GRPC front end" << std::endl;
-  std::unique_ptr<FrontEnd> frontEnd =
-      std::make_unique<GrpcFrontEnd>(_port, MAX_CLIENTS);
+  // tags and QR codes are detected at full resolution unless asked otherwise
+  int decodeResolution = _reducedDecode ? _maxResolution : 0;
+  std::unique_ptr<FrontEnd> frontEnd;
+  if (_frontEndType == "async") {
+    frontEnd = std::make_unique<AsyncGrpcFrontEnd>(
+        _port, _grpcThreads, _localizeThreads, _queueSize, _queueTimeout,
+        decodeResolution);
+  } else {
+    frontEnd = std::make_unique<GrpcFrontEnd>(_port, _maxClients,
+                                              decodeResolution, _streamWindow);
+  }
+  // callbacks first, since the front end may serve as soon as it starts
+  frontEnd->registerLocalizeFunc(
+      std::bind(&Run::localize, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3,
+                std::placeholders::_4, std::placeholders::_5));
+  frontEnd->registerGetLabelsFunc(
+      std::bind(&Run::getLabels, this, std::placeholders::_1));
+  frontEnd->registerGetLabelsVersionFunc(
+      std::bind(&Run::getLabelsVersion, this));
   if (frontEnd->start() == false) {
     std::cerr << "starting GRPC front end failed";
     return 1;
   }
-  frontEnd->registerLocalizeFunc(
-      std::bind(&Run::localize, this, std::placeholders::_1,
-                std::placeholders::_2, std::placeholders::_3));
-  frontEnd->registerGetLabelsFunc(std::bind(&Run::getLabels, this));
   std::cout << "Initialization Done" << std::endl;
 
   return app.exec();
@@ -134,16 +303,18 @@ void Run::printUsage(const po::options_description &desc) {
 // must be thread safe
 std::pair<int, Transform> Run::localize(const cv::Mat &image,
                                         const CameraModel &camera,
-                                        std::vector<FoundItem> *items) {
+                                        std::vector<FoundItem> *items,
+                                        PoseStats *stats, Session *session) {
   std::cout << "***New Query Image***" << std::endl;
   std::vector<FoundItem> qrResults;
-  int dbId;
+  int dbId = -1;
   Transform imgPose;
   long startTime;
   long totalStartTime = Utility::getTime();
 
   std::pair<std::vector<int>, std::vector<Transform>> aprilDetectResult;
   std::pair<int, Transform> imageLocResultPose;
+  PoseStats imageLocStats;
 
   QFuture<std::pair<std::vector<int>, std::vector<Transform>>>
       aprilDetectWatcher;
@@ -153,19 +324,14 @@ std::pair<int, Transform> Run::localize(const cv::Mat &image,
   QFuture<std::vector<FoundItem>> qrWatcher =
       QtConcurrent::run(_QR.get(), &QR::QRdetect, image);
 
-  if (_saveImage) {
-    QtConcurrent::run(
-        [=]() { imwrite(std::to_string(Utility::getTime()) + ".jpg", image); });
-  }
-
   if (!camera.isValid()) {
     std::cerr << "Warning: Camera is invalid." << std::endl;
   } else {
     // aprilTag extraction and localization
     aprilDetectWatcher = QtConcurrent::run(
         _aprilTag.get(), &Apriltag::aprilDetect, image, camera);
-    imageLocalizeWatcher =
-        QtConcurrent::run(this, &Run::imageLocalize, image, camera);
+    imageLocalizeWatcher = QtConcurrent::run(this, &Run::imageLocalize, image,
+                                             camera, &imageLocStats, session);
 
     aprilDetectResult = aprilDetectWatcher.result();
     // This lookup and localize part takes less than 1ms, so didn't put in
@@ -187,6 +353,19 @@ std::pair<int, Transform> Run::localize(const cv::Mat &image,
     } else {
       dbId = imageLocResultPose.first;
       imgPose = imageLocResultPose.second;
+      if (stats != nullptr) {
+        *stats = imageLocStats;
+      }
+    }
+
+    // frames of a stream may finish out of order, so they are ordered by
+    // when they arrived
+    if (session != nullptr) {
+      if (imgPose.isNull()) {
+        session->reset(totalStartTime);
+      } else {
+        session->update(dbId, imgPose, totalStartTime);
+      }
     }
 
     if (_visCount > 0) {
@@ -195,13 +374,10 @@ std::pair<int, Transform> Run::localize(const cv::Mat &image,
 
     if (imgPose.isNull() == false && items != nullptr) {
       // visibility
-      {
-        std::lock_guard<std::mutex> lock(_visibilityMutex);
-        startTime = Utility::getTime();
-        *items = _visibility->process(dbId, camera, imgPose);
-        long visibilityTime = Utility::getTime() - startTime;
-        std::cout << "Time visibility " << visibilityTime << " ms" << std::endl;
-      }
+      startTime = Utility::getTime();
+      *items = _visibility->process(dbId, camera, imgPose);
+      long visibilityTime = Utility::getTime() - startTime;
+      std::cout << "Time visibility " << visibilityTime << " ms" << std::endl;
     }
   }
 
@@ -220,54 +396,99 @@ std::pair<int, Transform> Run::localize(const cv::Mat &image,
                       imageLocResultPose);
   }
 
+  if (_debugCapture != nullptr) {
+    _debugCapture->capture(image, dbId, imgPose);
+  }
+
   return std::make_pair(dbId, imgPose);
 }
 
 std::pair<int, Transform> Run::imageLocalize(const cv::Mat &image,
-                                             const CameraModel &camera) {
+                                             const CameraModel &camera,
+                                             PoseStats *stats,
+                                             const Session *session) {
+  // all stages are reentrant, so concurrent requests don't wait for each other
+  PoseStats localStats;
+  if (stats == nullptr) {
+    stats = &localStats;
+  }
+
+  // downsampling. The pose does not depend on the scale, because the
+  // intrinsics are scaled with the image. Visibility projects labels with
+  // the original camera, so found items stay in the original frame.
+  long startTime = Utility::getTime();
+  cv::Mat queryImage = image;
+  CameraModel queryCamera = camera;
+  bool downsampled = Utility::downsample(image, camera, _maxResolution,
+                                         queryImage, queryCamera);
+  long resizeTime = Utility::getTime() - startTime;
+
   // feature extraction
   std::vector<cv::KeyPoint> keyPoints;
   cv::Mat descriptors;
-  long featureTime;
-  {
-    std::lock_guard<std::mutex> lock(_featureMutex);
-    long startTime = Utility::getTime();
-    _feature->extract(image, keyPoints, descriptors);
-    featureTime = Utility::getTime() - startTime;
-  }
+  startTime = Utility::getTime();
+  _feature->extract(queryImage, keyPoints, descriptors);
+  long featureTime = Utility::getTime() - startTime;
 
   // word search
-  std::vector<int> wordIds;
-  long wordSearchTime;
-  {
-    std::lock_guard<std::mutex> lock(_wordSearchMutex);
-    long startTime = Utility::getTime();
-    wordIds = _wordSearch->search(descriptors);
-    wordSearchTime = Utility::getTime() - startTime;
+  startTime = Utility::getTime();
+  std::vector<int> wordIds = _wordSearch->search(descriptors);
+  long wordSearchTime = Utility::getTime() - startTime;
+
+  // room search, skipped while the stream is tracked in its room
+  int roomId = -1;
+  Transform guess;
+  bool tracking = session != nullptr &&
+                  session->predictPose(Utility::getTime(), _sessionTimeout,
+                                       roomId, guess);
+  startTime = Utility::getTime();
+  std::vector<std::pair<int, float>> rooms;
+  if (!tracking) {
+    rooms = _roomSearch->search(wordIds, std::max(_topRooms, 1));
   }
-
-  // room search
-  int dbId;
-  long roomSearchTime;
-  {
-    std::lock_guard<std::mutex> lock(_roomSearchMutex);
-    long startTime = Utility::getTime();
-    dbId = _roomSearch->search(wordIds);
-    roomSearchTime = Utility::getTime() - startTime;
+  long roomSearchTime = Utility::getTime() - startTime;
+
+  // PnP. A tracked stream is localized in its room, seeded with the pose
+  // predicted from its last frames, and globally if that fails.
+  startTime = Utility::getTime();
+  std::pair<int, Transform> result;
+  if (tracking) {
+    result = std::make_pair(
+        roomId, _perspective->localize(wordIds, keyPoints, descriptors,
+                                       queryCamera, roomId, stats, nullptr,
+                                       &guess));
+    if (result.second.isNull() || stats->inliers < _trackInliers) {
+      std::cout << "Tracking lost in room " << roomId << std::endl;
+      rooms = _roomSearch->search(wordIds, std::max(_topRooms, 1));
+      result = verifyRooms(rooms, wordIds, keyPoints, descriptors,
+                           queryCamera, stats);
+    } else {
+      std::cout << "Tracked in room " << roomId << std::endl;
+    }
+  } else {
+    result = verifyRooms(rooms, wordIds, keyPoints, descriptors, queryCamera,
+                         stats);
   }
-
-  // PnP
-  Transform pose;
-  long perspectiveTime;
-  {
-    std::lock_guard<std::mutex> lock(_perspectiveMutex);
-    long startTime = Utility::getTime();
-    pose =
-        _perspective->localize(wordIds, keyPoints, descriptors, camera, dbId);
-    perspectiveTime = Utility::getTime() - startTime;
+  int dbId = result.first;
+  Transform pose = result.second;
+  long perspectiveTime = Utility::getTime() - startTime;
+
+  // a pose with few inliers is likely wrong, and clients would rather retry
+  if (!pose.isNull() && stats->inliers < _minInliers) {
+    std::cout << "Dropped pose with " << stats->inliers << " inliers"
+              << std::endl;
+    pose = Transform();
   }
 
-  std::cout << "Time feature: " << featureTime << " ms" << std::endl;
+  if (downsampled) {
+    double pixelRatio = static_cast<double>(image.total()) / queryImage.total();
+    std::cout << "Time resize: " << resizeTime << " ms, " << image.cols << "x"
+              << image.rows << " to " << queryImage.cols << "x"
+              << queryImage.rows << ", " << pixelRatio << "x fewer pixels"
+              << std::endl;
+  }
+  std::cout << "Time feature: " << featureTime << " ms, " << keyPoints.size()
+            << " keypoints" << std::endl;
   std::cout << "Time wordSearch: " << wordSearchTime << " ms" << std::endl;
   std::cout << "Time roomSearch: " << roomSearchTime << " ms" << std::endl;
   std::cout << "Time perspective: " << perspectiveTime << " ms" << std::endl;
@@ -275,6 +496,64 @@ std::pair<int, Transform> Run::imageLocalize(const cv::Mat &image,
   return std::make_pair(dbId, pose);
 }
 
+std::pair<int, Transform>
+Run::verifyRooms(const std::vector<std::pair<int, float>> &rooms,
+                 const std::vector<int> &wordIds,
+                 const std::vector<cv::KeyPoint> &keyPoints,
+                 const cv::Mat &descriptors, const CameraModel &camera,
+                 PoseStats *stats) {
+  int dbId = rooms.empty() ? -1 : rooms[0].first;
+  Transform pose;
+  if (rooms.size() <= 1) {
+    pose = _perspective->localize(wordIds, keyPoints, descriptors, camera,
+                                  dbId, stats);
+  } else {
+    // verify the candidate rooms concurrently. The first pose with enough
+    // inliers wins and cancels the others, otherwise the pose with the most
+    // inliers does, the higher ranked room on ties.
+    const int numRooms = rooms.size();
+    std::vector<Transform> poses(numRooms);
+    std::vector<PoseStats> roomStats(numRooms);
+    std::atomic<bool> cancel(false);
+    std::atomic<int> winner(-1);
+    auto verify = [&](int i) {
+      poses[i] = _perspective->localize(wordIds, keyPoints, descriptors,
+                                        camera, rooms[i].first,
+                                        &roomStats[i], &cancel);
+      int none = -1;
+      if (!poses[i].isNull() && roomStats[i].inliers >= _acceptInliers &&
+          winner.compare_exchange_strong(none, i)) {
+        cancel = true;
+      }
+    };
+    std::vector<QFuture<void>> futures;
+    for (int i = 1; i < numRooms; i++) {
+      futures.emplace_back(QtConcurrent::run(verify, i));
+    }
+    verify(0);
+    for (auto &future : futures) {
+      future.waitForFinished();
+    }
+
+    int best = winner;
+    for (int i = 0; best < 0 && i < numRooms; i++) {
+      if (!poses[i].isNull() &&
+          (best < 0 || roomStats[i].inliers > roomStats[best].inliers)) {
+        best = i;
+      }
+    }
+    if (best >= 0) {
+      dbId = rooms[best].first;
+      pose = poses[best];
+      *stats = roomStats[best];
+    }
+    std::cout << "Verified " << numRooms << " rooms, picked room " << dbId
+              << (winner >= 0 ? " early" : "") << std::endl;
+  }
+
+  return std::make_pair(dbId, pose);
+}
+
 void Run::calculateAndSaveAprilTagPose(
     std::vector<Transform> aprilTagPosesInCamFrame,
     std::vector<int> aprilTagCodes,
@@ -294,6 +573,8 @@ void Run::calculateAndSaveAprilTagPose(
   }
 }
 
-std::map<int, std::vector<Label>> Run::getLabels() {
-  return _adapter->getLabels();
+std::map<int, std::vector<Label>> Run::getLabels(uint64_t &version) {
+  return _adapter->getLabels(version);
 }
+
+uint64_t Run::getLabelsVersion() { return _adapter->getLabelsVersion(); }
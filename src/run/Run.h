@@ -7,18 +7,31 @@
 #include "lib/algo/WordSearch.h"
 #include "lib/algo/Apriltag.h"
 #include "lib/algo/QR.h"
+#include "lib/front_end/grpc/AsyncGrpcFrontEnd.h"
 #include <boost/program_options.hpp>
 #include <memory>
-#include <mutex>
 #include <opencv2/core/core.hpp>
 #include "lib/visualize/visualize.h"
+#include "lib/adapter/artifact/Artifact.h"
 #include "lib/adapter/rtabmap/RTABMapAdapter.h"
 
+// "sync", or "async" for the completion queue front end
+#define FRONT_END "sync"
 #define MAX_CLIENTS 10
+#define MAX_RESOLUTION 0
+#define MIN_INLIERS 0
+#define TOP_ROOMS 1
+#define ACCEPT_INLIERS 30
+// milliseconds after which the last pose of a stream is no longer a prior
+#define SESSION_TIMEOUT 2000
+// inliers a tracked pose needs before the stream falls back to room search
+#define TRACK_INLIERS 30
 
 namespace po = boost::program_options;
 class CameraModel;
+class DebugCapture;
 class FoundItem;
+class Session;
 
 class Run final {
 public:
@@ -29,27 +42,62 @@ private:
 
   // must be thread-safe
   // camera is optional, no image localization is performed if not provided
-  std::pair<int, Transform> localize(const cv::Mat &image, const CameraModel &camera, std::vector<FoundItem> *items); 
-  std::map<int, std::vector<Label>> getLabels();
+  // stats describe the image localization, and are left empty if the pose
+  // comes from an AprilTag
+  // session is the tracking state of the stream, and is updated with the pose
+  std::pair<int, Transform> localize(const cv::Mat &image, const CameraModel &camera, std::vector<FoundItem> *items, PoseStats *stats, Session *session);
+  std::map<int, std::vector<Label>> getLabels(uint64_t &version);
+  uint64_t getLabelsVersion();
   bool qrExtract(const cv::Mat &image, std::vector<FoundItem> *results);
   
   void calculateAndSaveAprilTagPose(std::vector<Transform> aprilTagPosesInCamFrame,std::vector<int> aprilTagCodes,std::pair<int, Transform> imageLocResultPose);  
 
   std::vector<std::pair<int, Transform>> aprilLocalize(const cv::Mat &im, const CameraModel &camera, double tagSize,std::vector<Transform> *tagPoseInCamFrame, std::vector<int> *tagCodes);
 
-  std::pair<int, Transform> imageLocalize(const cv::Mat &image, const CameraModel &camera);
+  std::pair<int, Transform> imageLocalize(const cv::Mat &image, const CameraModel &camera, PoseStats *stats, const Session *session);
+
+  // localize in the first of the ranked rooms that verifies
+  std::pair<int, Transform> verifyRooms(const std::vector<std::pair<int, float>> &rooms, const std::vector<int> &wordIds, const std::vector<cv::KeyPoint> &keyPoints, const cv::Mat &descriptors, const CameraModel &camera, PoseStats *stats);
 
 private:
   int _port;
+  std::string _frontEndType;
+  int _maxClients;
+  int _streamWindow;
+  int _grpcThreads;
+  int _localizeThreads;
+  int _queueSize;
+  int _queueTimeout;
   int _featureLimit;
+  int _featureThreads;
+  int _maxResolution;
+  bool _reducedDecode;
   int _corrLimit;
+  std::string _pnpType;
+  int _minInliers;
+  int _topRooms;
+  int _acceptInliers;
+  int _sessionTimeout;
+  int _trackInliers;
+  float _occlusionVoxel;
+  int _maxItems;
   float _distRatio;
+  int _clusterBatchSize;
+  int _clusterChecks;
+  int _loadThreads;
+  AnnParams _annParams;
   std::vector<std::string> _dbFiles;
+  std::string _artifactPath;
   bool _saveImage;
+  std::string _captureDir;
+  double _captureRate;
+  int _captureRing;
   int _visCount;
   double _tagSize;
   std::unique_ptr<RTABMapAdapter> _adapter;
+  std::unique_ptr<Artifact> _artifact;
   std::unique_ptr<Visualize> _visualize;
+  std::unique_ptr<DebugCapture> _debugCapture;
 
   std::unique_ptr<Feature> _feature;
   std::unique_ptr<WordSearch> _wordSearch;
@@ -58,10 +106,4 @@ private:
   std::unique_ptr<Visibility> _visibility;
   std::unique_ptr<Apriltag> _aprilTag;
   std::unique_ptr<QR> _QR;
-
-  std::mutex _featureMutex;
-  std::mutex _wordSearchMutex;
-  std::mutex _roomSearchMutex;
-  std::mutex _perspectiveMutex;
-  std::mutex _visibilityMutex;
 };
@@ -195,9 +195,9 @@ void Visualizer::printUsage(const po::options_description &desc) {
 Transform Visualizer::localize(const cv::Mat &image, const CameraModel &camera,
                                int featureLimit, int corrLimit,
                                double distRatio) {
-  const std::map<int, Word> &words = _adapter.getWords();
+  const WordStore &words = _adapter.getWords();
   const std::map<int, Room> &rooms = _adapter.getRooms();
-  const std::map<int, std::vector<Label>> &labels = _adapter.getLabels();
+  std::map<int, std::vector<Label>> labels = _adapter.getLabels();
   Feature feature(featureLimit);
   WordSearch wordSearch(words);
   RoomSearch roomSearch(rooms, words);